@@ -0,0 +1,427 @@
+#include "hsqr/rwlock.h"
+#include "hsqr/rwmutex-cohort.h"
+#include "hsqr/rwmutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <pthread.h>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// throughput and acquisition latency of the read/write locks. every run
+// starts the given number of threads, each one doing read or write critical
+// sections for the given duration, and reports one JSON object per run:
+//
+//   rwlock_bench [--locks=a,b] [--threads=1,2] [--write-pct=0,10]
+//                [--cs=0,100] [--payload=8,64] [--duration-ms=200]
+//
+// cs is the number of spin iterations inside the critical section, payload
+// the number of bytes read or written in it. the acquisition latency is the
+// time spent in read_lock/write_lock.
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Payload {
+    explicit Payload(size_t bytes = 8)
+        : words(std::max<size_t>(1, bytes / sizeof(uint64_t)), 0)
+    {
+    }
+    uint64_t read() const
+    {
+        uint64_t sum = 0;
+        for (auto w : words) {
+            sum += w;
+        }
+        return sum;
+    }
+    void write()
+    {
+        for (auto& w : words) {
+            ++w;
+        }
+    }
+    std::vector<uint64_t> words;
+};
+
+void spin(int iterations)
+{
+    for (int i = 0; i < iterations; ++i) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+}
+
+// every lock is wrapped with the same interface: read/write take the lock,
+// call the given function to record the acquisition time, run the critical
+// section and release the lock
+template <typename M>
+class MutexBench {
+public:
+    explicit MutexBench(size_t payload)
+        : m_payload(payload)
+    {
+    }
+    template <typename F>
+    uint64_t read(int cs, F&& acquired)
+    {
+        m_mutex.read_lock();
+        acquired();
+        auto v = m_payload.read();
+        spin(cs);
+        m_mutex.read_unlock();
+        return v;
+    }
+    template <typename F>
+    void write(int cs, F&& acquired)
+    {
+        m_mutex.write_lock();
+        acquired();
+        m_payload.write();
+        spin(cs);
+        m_mutex.write_unlock();
+    }
+
+private:
+    M m_mutex;
+    Payload m_payload;
+};
+
+class RWLockBench {
+public:
+    explicit RWLockBench(size_t payload)
+        : m_lock(std::in_place, payload)
+    {
+    }
+    template <typename F>
+    uint64_t read(int cs, F&& acquired)
+    {
+        auto v = m_lock.read();
+        acquired();
+        auto sum = (*v).read();
+        spin(cs);
+        return sum;
+    }
+    template <typename F>
+    void write(int cs, F&& acquired)
+    {
+        auto v = m_lock.write();
+        acquired();
+        (*v).write();
+        spin(cs);
+    }
+
+private:
+    // the default mutex is the checked one in debug builds
+    hsqr::RWLock<Payload, hsqr::RWMutexUnchecked> m_lock;
+};
+
+class SharedMutexBench {
+public:
+    explicit SharedMutexBench(size_t payload)
+        : m_payload(payload)
+    {
+    }
+    template <typename F>
+    uint64_t read(int cs, F&& acquired)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        acquired();
+        auto v = m_payload.read();
+        spin(cs);
+        return v;
+    }
+    template <typename F>
+    void write(int cs, F&& acquired)
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        acquired();
+        m_payload.write();
+        spin(cs);
+    }
+
+private:
+    std::shared_mutex m_mutex;
+    Payload m_payload;
+};
+
+class PthreadBench {
+public:
+    explicit PthreadBench(size_t payload)
+        : m_payload(payload)
+    {
+        pthread_rwlock_init(&m_lock, nullptr);
+    }
+    ~PthreadBench()
+    {
+        pthread_rwlock_destroy(&m_lock);
+    }
+    template <typename F>
+    uint64_t read(int cs, F&& acquired)
+    {
+        pthread_rwlock_rdlock(&m_lock);
+        acquired();
+        auto v = m_payload.read();
+        spin(cs);
+        pthread_rwlock_unlock(&m_lock);
+        return v;
+    }
+    template <typename F>
+    void write(int cs, F&& acquired)
+    {
+        pthread_rwlock_wrlock(&m_lock);
+        acquired();
+        m_payload.write();
+        spin(cs);
+        pthread_rwlock_unlock(&m_lock);
+    }
+
+private:
+    pthread_rwlock_t m_lock;
+    Payload m_payload;
+};
+
+struct Config {
+    int threads;
+    int writePct;
+    int cs;
+    size_t payload;
+    std::chrono::milliseconds duration;
+};
+
+struct Result {
+    uint64_t ops = 0;
+    double seconds = 0;
+    std::vector<uint32_t> readLatency;
+    std::vector<uint32_t> writeLatency;
+};
+
+// keep at most this many latency samples per thread and kind
+constexpr size_t MaxSamples = 1 << 18;
+
+template <typename Bench>
+Result run(const Config& config)
+{
+    Bench bench(config.payload);
+    std::atomic<bool> start { false };
+    std::atomic<bool> stop { false };
+    std::vector<Result> results(config.threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < config.threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            auto& result = results[t];
+            result.readLatency.reserve(MaxSamples);
+            result.writeLatency.reserve(MaxSamples);
+            // xorshift, so the read/write mix does not depend on a shared rng
+            uint32_t rng = 2463534242u + t;
+            uint64_t sink = 0;
+            while (start.load() == false) {
+                std::this_thread::yield();
+            }
+            while (stop.load(std::memory_order_relaxed) == false) {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+                bool write = static_cast<int>(rng % 100) < config.writePct;
+                auto& samples = write ? result.writeLatency : result.readLatency;
+                auto begin = Clock::now();
+                auto acquired = [&]() {
+                    if (samples.size() < MaxSamples) {
+                        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            Clock::now() - begin)
+                                      .count();
+                        samples.push_back(static_cast<uint32_t>(
+                            std::min<int64_t>(ns, UINT32_MAX)));
+                    }
+                };
+                if (write) {
+                    bench.write(config.cs, acquired);
+                } else {
+                    sink += bench.read(config.cs, acquired);
+                }
+                ++result.ops;
+            }
+            volatile uint64_t keep = sink;
+            (void)keep;
+        }));
+    }
+
+    auto begin = Clock::now();
+    start = true;
+    std::this_thread::sleep_for(config.duration);
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    Result total;
+    total.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    for (auto& r : results) {
+        total.ops += r.ops;
+        total.readLatency.insert(total.readLatency.end(), r.readLatency.begin(),
+            r.readLatency.end());
+        total.writeLatency.insert(total.writeLatency.end(),
+            r.writeLatency.begin(), r.writeLatency.end());
+    }
+    return total;
+}
+
+uint32_t percentile(std::vector<uint32_t>& samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+void report(std::ostream& out, const std::string& lock, const Config& config,
+    Result& result)
+{
+    out << "{\"lock\":\"" << lock << "\""
+        << ",\"threads\":" << config.threads
+        << ",\"write_pct\":" << config.writePct
+        << ",\"cs\":" << config.cs
+        << ",\"payload\":" << config.payload
+        << ",\"ops\":" << result.ops
+        << ",\"ops_per_sec\":" << static_cast<uint64_t>(result.ops / result.seconds);
+    std::pair<const char*, std::vector<uint32_t>*> kinds[] = {
+        { "read", &result.readLatency },
+        { "write", &result.writeLatency },
+    };
+    for (auto& kind : kinds) {
+        out << ",\"" << kind.first << "_p50_ns\":" << percentile(*kind.second, 0.5)
+            << ",\"" << kind.first << "_p99_ns\":" << percentile(*kind.second, 0.99)
+            << ",\"" << kind.first << "_p999_ns\":" << percentile(*kind.second, 0.999);
+    }
+    out << "}";
+}
+
+struct Lock {
+    const char* name;
+    std::function<Result(const Config&)> run;
+};
+
+const std::vector<Lock>& locks()
+{
+    static const std::vector<Lock> l = {
+        { "RWMutexUnchecked", run<MutexBench<hsqr::RWMutexUnchecked>> },
+        { "RWMutexChecked", run<MutexBench<hsqr::RWMutexChecked>> },
+        { "RWMutexNoBackoff",
+            run<MutexBench<hsqr::RWMutexImpl<hsqr::RWMutexNullDeadLockDetector,
+                hsqr::RWMutexWriterPreferring, hsqr::RWMutexNullStats,
+                hsqr::RWMutexNoBackoff>>> },
+        { "RWMutexCohort", run<MutexBench<hsqr::RWMutexCohortUnchecked>> },
+        { "RWLock", run<RWLockBench> },
+        { "std::shared_mutex", run<SharedMutexBench> },
+        { "pthread_rwlock_t", run<PthreadBench> },
+    };
+    return l;
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& value)
+{
+    std::vector<T> list;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::stringstream is(item);
+        T v;
+        is >> v;
+        list.push_back(v);
+    }
+    return list;
+}
+
+std::vector<std::string> parse_names(const std::string& value)
+{
+    std::vector<std::string> list;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        list.push_back(item);
+    }
+    return list;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int hw = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<int> threads;
+    for (int t = 1; t < hw; t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(hw);
+    std::vector<int> writePct = { 0, 1, 10, 50 };
+    std::vector<int> cs = { 0, 100, 1000 };
+    std::vector<size_t> payload = { 8, 64, 1024 };
+    std::vector<std::string> names;
+    for (auto& l : locks()) {
+        names.push_back(l.name);
+    }
+    int durationMs = 200;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        auto key = arg.substr(0, eq);
+        auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--threads") {
+            threads = parse_list<int>(value);
+        } else if (key == "--write-pct") {
+            writePct = parse_list<int>(value);
+        } else if (key == "--cs") {
+            cs = parse_list<int>(value);
+        } else if (key == "--payload") {
+            payload = parse_list<size_t>(value);
+        } else if (key == "--locks") {
+            names = parse_names(value);
+        } else if (key == "--duration-ms") {
+            durationMs = std::atoi(value.c_str());
+        } else {
+            std::cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "[";
+    bool first = true;
+    for (auto& name : names) {
+        auto lock = std::find_if(locks().begin(), locks().end(),
+            [&](const Lock& l) { return name == l.name; });
+        if (lock == locks().end()) {
+            std::cerr << "unknown lock " << name << "\n";
+            return 1;
+        }
+        for (auto t : threads) {
+            for (auto w : writePct) {
+                for (auto c : cs) {
+                    for (auto p : payload) {
+                        Config config { t, w, c, p, std::chrono::milliseconds(durationMs) };
+                        auto result = lock->run(config);
+                        std::cout << (first ? "\n  " : ",\n  ");
+                        report(std::cout, lock->name, config, result);
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    std::cout << "\n]\n";
+    return 0;
+}
@@ -0,0 +1,192 @@
+#ifndef HSQR_CONDITION_VARIABLE_H_
+#define HSQR_CONDITION_VARIABLE_H_
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "hsqr/futex.h"
+#include "hsqr/rwlock.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWConditionVariableDiag;
+};
+
+// condition variable for the guards of RWLock: wait() releases the read or
+// write lock held by the guard, sleeps until a notification and takes the
+// same lock back, no separate mutex is needed. the predicate is checked
+// under the guard's lock, spurious wake ups are possible as with
+// std::condition_variable.
+//
+// the waiters sleep on one futex word, bumped by every notification, with
+// a mask telling readers from writers:
+//  - notify_all() wakes every reader, they take the read lock together, but
+//    only one writer. each writer that got the write lock back wakes the
+//    next one, so the woken writers do not all rush to the lock at once
+//  - notify_one() wakes one waiter, reader or writer
+// a notification with nobody waiting costs one atomic increment.
+//
+// a read guard of a frozen lock (see RWLock::freeze()) takes the read back
+// the way a new read guard would: frozen again if the lock is still frozen,
+// with the read lock if a write thawed it meanwhile. the predicate must be
+// changed under a write guard of the same lock, a notification that follows
+// the change is then never lost.
+class RWConditionVariable {
+    friend struct hsqr::test::RWConditionVariableDiag;
+
+public:
+    RWConditionVariable() noexcept = default;
+    RWConditionVariable(const RWConditionVariable&) = delete;
+    RWConditionVariable& operator=(const RWConditionVariable&) = delete;
+
+    void notify_one()
+    {
+        m_sequence.fetch_add(1);
+        if (m_readers.load() != 0 || m_writers.load() != 0) {
+            detail::futex_wake(word(), 1);
+        }
+    }
+    void notify_all()
+    {
+        m_sequence.fetch_add(1);
+        if (m_readers.load() != 0) {
+            detail::futex_wake(word(), INT_MAX, detail::FutexWaitReaders);
+        }
+        if (auto writers = m_writers.load()) {
+            m_chained.store(writers);
+            wake_writer();
+        }
+    }
+
+    template <typename Guard>
+    void wait(Guard& guard)
+    {
+        wait_on(guard, nullptr);
+    }
+    template <typename Guard, typename Predicate>
+    void wait(Guard& guard, Predicate pred)
+    {
+        while (!pred()) {
+            wait_on(guard, nullptr);
+        }
+    }
+    template <typename Guard, typename Rep, typename Period>
+    std::cv_status wait_for(
+        Guard& guard, const std::chrono::duration<Rep, Period>& duration)
+    {
+        return wait_until(guard, std::chrono::steady_clock::now() + duration);
+    }
+    template <typename Guard, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Guard& guard, const std::chrono::duration<Rep, Period>& duration,
+        Predicate pred)
+    {
+        return wait_until(
+            guard, std::chrono::steady_clock::now() + duration, std::move(pred));
+    }
+    template <typename Guard, typename Clock, typename Duration>
+    std::cv_status wait_until(
+        Guard& guard, const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        auto steadyDeadline = to_steady(deadline);
+        wait_on(guard, &steadyDeadline);
+        return Clock::now() < deadline ? std::cv_status::no_timeout
+                                       : std::cv_status::timeout;
+    }
+    // returns the last value of the predicate
+    template <typename Guard, typename Clock, typename Duration, typename Predicate>
+    bool wait_until(Guard& guard,
+        const std::chrono::time_point<Clock, Duration>& deadline, Predicate pred)
+    {
+        auto steadyDeadline = to_steady(deadline);
+        while (!pred()) {
+            if (Clock::now() >= deadline) {
+                return pred();
+            }
+            wait_on(guard, &steadyDeadline);
+        }
+        return true;
+    }
+
+private:
+    using Deadline = detail::FutexDeadline;
+
+    const uint32_t* word() const
+    {
+        return detail::futex_word(m_sequence);
+    }
+    template <typename Clock, typename Duration>
+    static Deadline to_steady(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        if constexpr (std::is_same<Clock, std::chrono::steady_clock>::value) {
+            return std::chrono::ceil<Deadline::duration>(deadline);
+        } else {
+            return std::chrono::steady_clock::now()
+                + std::chrono::ceil<Deadline::duration>(deadline - Clock::now());
+        }
+    }
+
+    // the sequence is read while the lock is still held: a notification
+    // after the release changes it and the futex wait returns at once
+    template <typename Guard>
+    void wait_on(Guard& guard, const Deadline* deadline)
+    {
+        if (!guard.m_state) {
+            throw std::logic_error("Invalid call to wait");
+        }
+        auto& waiters = Guard::Write ? m_writers : m_readers;
+        auto sequence = m_sequence.load();
+        waiters.fetch_add(1);
+        guard.unlock();
+        detail::futex_wait(word(), sequence,
+            Guard::Write ? detail::FutexWaitWriters : detail::FutexWaitReaders,
+            deadline);
+        waiters.fetch_sub(1);
+        try {
+            guard.lock();
+        } catch (...) {
+            // the guard does not hold the lock anymore
+            guard.m_state = nullptr;
+            throw;
+        }
+        if constexpr (Guard::Write) {
+            wake_writer();
+        }
+    }
+    // pass a notify_all() on to the next sleeping writer. a wake that finds
+    // nobody asleep uses up its turn: the writers that did not sleep yet
+    // see the new sequence
+    void wake_writer()
+    {
+        auto chained = m_chained.load();
+        while (chained != 0) {
+            if (!m_chained.compare_exchange_weak(chained, chained - 1)) {
+                continue;
+            }
+            if (detail::futex_wake(word(), 1, detail::FutexWaitWriters) != 0) {
+                return;
+            }
+            chained = m_chained.load();
+        }
+    }
+
+    std::atomic<uint32_t> m_sequence { 0 };
+    // threads in wait, per kind of guard
+    std::atomic<uint32_t> m_readers { 0 };
+    std::atomic<uint32_t> m_writers { 0 };
+    // writers a notify_all() still has to wake
+    std::atomic<uint32_t> m_chained { 0 };
+};
+
+} // namespace hsqr
+
+#endif // HSQR_CONDITION_VARIABLE_H_
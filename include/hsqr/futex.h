@@ -0,0 +1,128 @@
+#ifndef HSQR_FUTEX_H_
+#define HSQR_FUTEX_H_
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
+
+namespace hsqr {
+namespace detail {
+
+    // wake masks used to select a class of waiters parked on the same word
+    constexpr uint32_t FutexWaitAny = 0xffffffffu;
+    constexpr uint32_t FutexWaitReaders = 0x1u;
+    constexpr uint32_t FutexWaitWriters = 0x2u;
+
+    inline const uint32_t* futex_word(const std::atomic<uint32_t>& word)
+    {
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+            "atomic word must have the layout of its value");
+        return reinterpret_cast<const uint32_t*>(&word);
+    }
+
+    // low and high 32 bit halves of a 64 bit atomic state word. the futex
+    // syscall only operates on 32 bit words, so waiters park on the half that
+    // carries the bits they are waiting for
+    inline const uint32_t* futex_low_word(const std::atomic<uint64_t>& state)
+    {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+            "atomic state must have the layout of its value");
+        auto p = reinterpret_cast<const uint32_t*>(&state);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return p + 1;
+#else
+        return p;
+#endif
+    }
+    inline const uint32_t* futex_high_word(const std::atomic<uint64_t>& state)
+    {
+        auto p = reinterpret_cast<const uint32_t*>(&state);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return p;
+#else
+        return p + 1;
+#endif
+    }
+
+    using FutexDeadline = std::chrono::steady_clock::time_point;
+
+    // private futexes only match waiters of the same process and are
+    // cheaper. shared ones work on memory mapped by several processes
+    enum class FutexScope {
+        Private,
+        Shared
+    };
+
+    // block while *addr == expected, or until the deadline if one is given.
+    // spurious wake ups are possible, callers must re-check their condition
+    // and the deadline
+    inline void futex_wait(const uint32_t* addr, uint32_t expected,
+        uint32_t mask = FutexWaitAny, const FutexDeadline* deadline = nullptr,
+        FutexScope scope = FutexScope::Private)
+    {
+#if defined(__linux__)
+        // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC time, which is
+        // the clock of steady_clock
+        timespec ts;
+        timespec* timeout = nullptr;
+        if (deadline != nullptr) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline->time_since_epoch())
+                          .count();
+            if (ns < 0) {
+                ns = 0;
+            }
+            ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+            ts.tv_nsec = static_cast<long>(ns % 1000000000);
+            timeout = &ts;
+        }
+        syscall(SYS_futex, addr,
+            scope == FutexScope::Private ? FUTEX_WAIT_BITSET_PRIVATE
+                                         : FUTEX_WAIT_BITSET,
+            expected, timeout, nullptr, mask);
+#else
+        (void)addr;
+        (void)expected;
+        (void)mask;
+        (void)deadline;
+        (void)scope;
+        std::this_thread::yield();
+#endif
+    }
+
+    // wake up to count waiters parked on addr with a matching mask. returns
+    // the number of waiters woken, 0 where waits are only yields
+    inline int futex_wake(const uint32_t* addr, int count = INT_MAX,
+        uint32_t mask = FutexWaitAny, FutexScope scope = FutexScope::Private)
+    {
+#if defined(__linux__)
+        auto woken = syscall(SYS_futex, addr,
+            scope == FutexScope::Private ? FUTEX_WAKE_BITSET_PRIVATE
+                                         : FUTEX_WAKE_BITSET,
+            count, nullptr, nullptr, mask);
+        return woken > 0 ? static_cast<int>(woken) : 0;
+#else
+        (void)addr;
+        (void)count;
+        (void)mask;
+        (void)scope;
+        return 0;
+#endif
+    }
+
+} // namespace detail
+} // namespace hsqr
+
+#endif // HSQR_FUTEX_H_
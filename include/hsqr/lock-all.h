@@ -0,0 +1,181 @@
+#ifndef HSQR_LOCK_ALL_H_
+#define HSQR_LOCK_ALL_H_
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "hsqr/rwmutex.h"
+
+namespace hsqr {
+
+// holds a read or a write lock taken on a mutex by lock_all()
+template <typename M, bool Write>
+class RWMutexGuard {
+public:
+    RWMutexGuard(M& mutex, std::adopt_lock_t)
+        : m_mutex(&mutex)
+    {
+    }
+    ~RWMutexGuard()
+    {
+        if (m_mutex) {
+            unlock();
+        }
+    }
+    RWMutexGuard(const RWMutexGuard&) = delete;
+    RWMutexGuard& operator=(const RWMutexGuard&) = delete;
+
+    RWMutexGuard(RWMutexGuard&& other) noexcept
+        : m_mutex(std::exchange(other.m_mutex, nullptr))
+    {
+    }
+    RWMutexGuard& operator=(RWMutexGuard&& other) noexcept
+    {
+        if (this != &other) {
+            if (m_mutex) {
+                unlock();
+            }
+            m_mutex = std::exchange(other.m_mutex, nullptr);
+        }
+        return *this;
+    }
+
+    M* mutex() const
+    {
+        return m_mutex;
+    }
+
+private:
+    void unlock()
+    {
+        if constexpr (Write) {
+            m_mutex->write_unlock();
+        } else {
+            m_mutex->read_unlock();
+        }
+    }
+
+    M* m_mutex;
+};
+
+// a lock that lock_all() takes on a mutex, then turns into a guard
+template <typename M, bool Write>
+class RWMutexIntent {
+public:
+    using guard_type = RWMutexGuard<M, Write>;
+
+    explicit RWMutexIntent(M& mutex)
+        : m_mutex(&mutex)
+    {
+    }
+    const void* lock_address() const
+    {
+        return m_mutex;
+    }
+    void lock()
+    {
+        if constexpr (Write) {
+            m_mutex->write_lock();
+        } else {
+            m_mutex->read_lock();
+        }
+    }
+    void unlock()
+    {
+        if constexpr (Write) {
+            m_mutex->write_unlock();
+        } else {
+            m_mutex->read_unlock();
+        }
+    }
+    guard_type adopt()
+    {
+        return guard_type(*m_mutex, std::adopt_lock);
+    }
+
+private:
+    M* m_mutex;
+};
+
+// intents for any mutex with the read_lock/write_lock interface
+template <typename M>
+RWMutexIntent<M, false> read_intent(M& mutex)
+{
+    return RWMutexIntent<M, false>(mutex);
+}
+template <typename M>
+RWMutexIntent<M, true> write_intent(M& mutex)
+{
+    return RWMutexIntent<M, true>(mutex);
+}
+
+namespace detail {
+
+    struct LockAllStep {
+        const void* address;
+        void* intent;
+        void (*lock)(void*);
+        void (*unlock)(void*);
+    };
+
+    template <typename Intent>
+    LockAllStep lock_all_step(Intent& intent)
+    {
+        return { intent.lock_address(), &intent,
+            [](void* i) { static_cast<Intent*>(i)->lock(); },
+            [](void* i) { static_cast<Intent*>(i)->unlock(); } };
+    }
+
+} // namespace detail
+
+// take several read and write locks at once without dead locking:
+//
+//   auto [to, from] = hsqr::lock_all(a.write_intent(), b.read_intent());
+//
+// the locks are taken in address order whatever the order of the arguments,
+// so two lock_all calls on the same locks never wait for each other in a
+// cycle, and nothing is retried. returns the guards in argument order. a
+// lock may appear only once. if taking a lock throws, the locks already
+// taken are released.
+template <typename... Intents>
+std::tuple<typename std::decay_t<Intents>::guard_type...> lock_all(
+    Intents&&... intents)
+{
+    std::array<detail::LockAllStep, sizeof...(Intents)> steps = {
+        detail::lock_all_step(intents)...
+    };
+    std::sort(steps.begin(), steps.end(),
+        [](const detail::LockAllStep& a, const detail::LockAllStep& b) {
+            return std::less<const void*>()(a.address, b.address);
+        });
+    for (std::size_t i = 1; i < steps.size(); ++i) {
+        if (steps[i].address == steps[i - 1].address) {
+            throw std::logic_error("lock_all() got the same lock twice");
+        }
+    }
+    std::size_t locked = 0;
+    try {
+        for (; locked < steps.size(); ++locked) {
+            steps[locked].lock(steps[locked].intent);
+        }
+    } catch (...) {
+        while (locked > 0) {
+            --locked;
+            steps[locked].unlock(steps[locked].intent);
+        }
+        throw;
+    }
+    return std::tuple<typename std::decay_t<Intents>::guard_type...>(
+        intents.adopt()...);
+}
+
+} // namespace hsqr
+
+#endif // HSQR_LOCK_ALL_H_
@@ -0,0 +1,44 @@
+#ifndef HSQR_PLATFORM_H_
+#define HSQR_PLATFORM_H_
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace hsqr {
+namespace detail {
+
+    // size used to pad hot atomics so they do not share a cache line
+    constexpr std::size_t CacheLineSize = 64;
+
+    // small sequential id of the calling thread, assigned on first use. used
+    // to spread threads over per-thread slots
+    inline std::size_t thread_index()
+    {
+        static std::atomic<std::size_t> next { 0 };
+        thread_local static std::size_t index = next.fetch_add(1);
+        return index;
+    }
+
+    // tell the cpu the thread is in a spin wait loop: lets the sibling
+    // hyper-thread run and avoids the memory order flush when the loop exits
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+} // namespace detail
+} // namespace hsqr
+
+#endif // HSQR_PLATFORM_H_
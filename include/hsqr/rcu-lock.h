@@ -0,0 +1,312 @@
+#ifndef HSQR_RCU_LOCK_H_
+#define HSQR_RCU_LOCK_H_
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+namespace detail {
+
+    // epoch based reclamation shared by all the RcuLock objects. a reader
+    // announces the global epoch it saw on entry and clears it on exit. an old
+    // version retired at epoch E is freed once every active reader announced
+    // an epoch >= E, i.e. entered after the version was unpublished.
+    //
+    // the domain is never destroyed: RcuLock objects with static storage and
+    // exiting threads may still use it while the other statics go away.
+    class RcuDomain {
+    public:
+        static RcuDomain& instance()
+        {
+            static RcuDomain* domain = new RcuDomain();
+            return *domain;
+        }
+        RcuDomain(const RcuDomain&) = delete;
+        RcuDomain& operator=(const RcuDomain&) = delete;
+        RcuDomain(RcuDomain&&) = delete;
+        RcuDomain& operator=(RcuDomain&&) = delete;
+
+        // wait free. nested sections only announce the outermost epoch
+        void read_lock()
+        {
+            auto& local = this->local();
+            if (local.nesting++ == 0) {
+                local.record->epoch.store(m_epoch.load());
+            }
+        }
+        void read_unlock()
+        {
+            auto& local = this->local();
+            assert(local.nesting > 0);
+            if (--local.nesting == 0) {
+                local.record->epoch.store(0, std::memory_order_release);
+            }
+        }
+        // wait until every reader that entered before the call left. the
+        // caller must not be inside a read section, it would wait for itself
+        void synchronize()
+        {
+            auto epoch = m_epoch.fetch_add(1) + 1;
+            for (auto r = m_records.load(); r != nullptr; r = r->next) {
+                while (true) {
+                    auto entered = r->epoch.load();
+                    if (entered == 0 || entered >= epoch) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        }
+        // must be called after p was unpublished
+        void retire(void* p, void (*deleter)(void*))
+        {
+            auto epoch = m_epoch.fetch_add(1) + 1;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_retired.push_back({ p, deleter, epoch });
+            reclaim_retired();
+        }
+        // free what no active reader can see anymore
+        void reclaim()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            reclaim_retired();
+        }
+
+    private:
+        RcuDomain() = default;
+
+        struct alignas(CacheLineSize) Record {
+            std::atomic<uint64_t> epoch { 0 };
+            std::atomic<bool> used { true };
+            Record* next = nullptr;
+        };
+        // per thread record, given back to the domain when the thread exits
+        struct Local {
+            Record* record;
+            unsigned nesting = 0;
+            ~Local()
+            {
+                record->used.store(false, std::memory_order_release);
+            }
+        };
+        struct Retired {
+            void* ptr;
+            void (*deleter)(void*);
+            uint64_t epoch;
+        };
+
+        Local& local()
+        {
+            thread_local static Local local { acquire_record() };
+            return local;
+        }
+        Record* acquire_record()
+        {
+            for (auto r = m_records.load(); r != nullptr; r = r->next) {
+                bool used = false;
+                if (r->used.compare_exchange_strong(used, true)) {
+                    return r;
+                }
+            }
+            auto record = new Record();
+            record->next = m_records.load();
+            while (!m_records.compare_exchange_weak(record->next, record)) {
+            }
+            return record;
+        }
+        // free every retired pointer older than the oldest active reader,
+        // needs m_mutex
+        void reclaim_retired()
+        {
+            auto oldest = UINT64_MAX;
+            for (auto r = m_records.load(); r != nullptr; r = r->next) {
+                auto epoch = r->epoch.load();
+                if (epoch != 0 && epoch < oldest) {
+                    oldest = epoch;
+                }
+            }
+            auto it = m_retired.begin();
+            while (it != m_retired.end()) {
+                if (it->epoch <= oldest) {
+                    it->deleter(it->ptr);
+                    it = m_retired.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        std::atomic<uint64_t> m_epoch { 1 };
+        std::atomic<Record*> m_records { nullptr };
+        std::mutex m_mutex;
+        std::vector<Retired> m_retired;
+    };
+
+} // namespace detail
+
+// read-copy-update sibling of RWLock. readers get a snapshot pointer without
+// blocking and without writing any shared cache line other than their own
+// epoch record. writers are serialized, work on a copy of the value and
+// publish it when the WriteGuard is released; if the guard is destroyed by an
+// exception the copy is discarded. an old version is freed by the first
+// write, reclaim() or synchronize() that finds all the readers that may see
+// it have left.
+//
+// guards must be released on the thread that took them.
+template <typename T>
+class RcuLock {
+public:
+    class ReadGuard;
+    class WriteGuard;
+
+    RcuLock()
+        : m_current(new T())
+    {
+    }
+    template <typename... Args>
+    RcuLock(std::in_place_t, Args&&... args)
+        : m_current(new T(std::forward<Args>(args)...))
+    {
+    }
+    ~RcuLock()
+    {
+        retire(m_current.load());
+    }
+    RcuLock(const RcuLock&) = delete;
+    RcuLock& operator=(const RcuLock&) = delete;
+    RcuLock(RcuLock&&) = delete;
+    RcuLock& operator=(RcuLock&&) = delete;
+
+    ReadGuard read()
+    {
+        return ReadGuard(m_current);
+    }
+    WriteGuard write()
+    {
+        return WriteGuard(*this);
+    }
+    // free the old versions, of every RcuLock, that no reader sees anymore
+    static void reclaim()
+    {
+        detail::RcuDomain::instance().reclaim();
+    }
+    // wait for the readers that may see an old version to leave, then free
+    // all the old versions. the caller must not hold a ReadGuard
+    static void synchronize()
+    {
+        auto& domain = detail::RcuDomain::instance();
+        domain.synchronize();
+        domain.reclaim();
+    }
+
+    class ReadGuard {
+    public:
+        ReadGuard(const std::atomic<T*>& current)
+        {
+            detail::RcuDomain::instance().read_lock();
+            m_value = current.load();
+        }
+        ~ReadGuard()
+        {
+            if (m_value) {
+                detail::RcuDomain::instance().read_unlock();
+            }
+        }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) const = delete;
+
+        ReadGuard(ReadGuard&& other) noexcept
+            : m_value(std::exchange(other.m_value, nullptr))
+        {
+        }
+        ReadGuard& operator=(ReadGuard&& other) noexcept
+        {
+            if (this != &other) {
+                if (m_value) {
+                    detail::RcuDomain::instance().read_unlock();
+                }
+                m_value = std::exchange(other.m_value, nullptr);
+            }
+            return *this;
+        }
+
+        const T& operator*() const
+        {
+            return *m_value;
+        }
+
+    private:
+        const T* m_value;
+    };
+
+    class WriteGuard {
+    public:
+        WriteGuard(RcuLock& lock)
+            : m_lock(&lock)
+            , m_guard(lock.m_writer)
+            , m_value(new T(*lock.m_current.load()))
+            , m_exceptions(std::uncaught_exceptions())
+        {
+        }
+        // publish the copy
+        ~WriteGuard()
+        {
+            if (m_lock && std::uncaught_exceptions() <= m_exceptions) {
+                m_lock->retire(m_lock->m_current.exchange(m_value.release()));
+            }
+        }
+        WriteGuard(const WriteGuard&) = delete;
+        WriteGuard& operator=(const WriteGuard&) const = delete;
+
+        WriteGuard(WriteGuard&& other) noexcept
+            : m_lock(std::exchange(other.m_lock, nullptr))
+            , m_guard(std::move(other.m_guard))
+            , m_value(std::move(other.m_value))
+            , m_exceptions(other.m_exceptions)
+        {
+        }
+        WriteGuard& operator=(WriteGuard&&) = delete;
+
+        T& operator*()
+        {
+            return *m_value;
+        }
+
+        const T& operator*() const
+        {
+            return *m_value;
+        }
+
+    private:
+        RcuLock* m_lock;
+        std::unique_lock<std::mutex> m_guard;
+        std::unique_ptr<T> m_value;
+        int m_exceptions;
+    };
+
+private:
+    static void retire(T* value)
+    {
+        detail::RcuDomain::instance().retire(value,
+            [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    std::atomic<T*> m_current;
+    std::mutex m_writer;
+};
+
+} // namespace hsqr
+
+#endif // HSQR_RCU_LOCK_H_
@@ -3,64 +3,560 @@
 
 #pragma once
 
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
 #include "hsqr/rwmutex.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <type_traits>
 #include <utility>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define HSQR_RWLOCK_COROUTINES 1
+#endif
+
 namespace hsqr {
 
 namespace test {
     struct RWLockDiag;
 };
 
-template <typename T, typename M = hsqr::RWMutex>
+class RWConditionVariable;
+
+namespace detail {
+
+    // a coroutine waiting for a RWLock, lives in the coroutine frame
+    struct RWLockWaiter {
+        RWLockWaiter* next = nullptr;
+        // take the lock for the waiter without blocking
+        bool (*try_lock)(RWLockWaiter*) = nullptr;
+        // resume the waiter once it got the lock
+        void (*resume)(RWLockWaiter*) = nullptr;
+    };
+
+    // coroutines waiting for a RWLock, and the threads lining up behind them,
+    // in arrival order. the waiters are not
+    // known to the mutex: they are granted the lock by the thread that
+    // queues them or by the next thread releasing the lock, which takes it on
+    // their behalf with a try lock. the head of the queue goes first, a
+    // waiter that can not get the lock stops the ones behind it.
+    class RWLockWaitQueue {
+    public:
+        // returns false if the waiter got the lock and must not suspend
+        bool push(RWLockWaiter* waiter)
+        {
+            RWLockWaiter* granted;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                waiter->next = nullptr;
+                *(m_head ? &m_tail->next : &m_head) = waiter;
+                m_tail = waiter;
+                // pairs with wake(): either the releasing thread sees the
+                // waiter or the try lock below sees the release
+                m_size.fetch_add(1, std::memory_order_acq_rel);
+                granted = grant();
+            }
+            bool suspend = true;
+            while (granted != nullptr) {
+                auto next = granted->next;
+                if (granted == waiter) {
+                    suspend = false;
+                } else {
+                    granted->resume(granted);
+                }
+                granted = next;
+            }
+            return suspend;
+        }
+        // true if nobody waits, a blocking lock may then go to the mutex
+        bool empty() const
+        {
+            return m_size.load(std::memory_order_acquire) == 0;
+        }
+        // called after every release of the lock. a read-modify-write on a
+        // line the mutex already owns when nobody waits
+        void wake()
+        {
+            if (m_size.fetch_add(0, std::memory_order_acq_rel) == 0) {
+                return;
+            }
+            RWLockWaiter* granted;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                granted = grant();
+            }
+            // the resumed coroutine may destroy the waiter
+            while (granted != nullptr) {
+                auto next = granted->next;
+                granted->resume(granted);
+                granted = next;
+            }
+        }
+
+    private:
+        // pop the waiters that get the lock, must hold m_mutex
+        RWLockWaiter* grant()
+        {
+            RWLockWaiter* granted = nullptr;
+            RWLockWaiter** last = &granted;
+            while (m_head != nullptr && m_head->try_lock(m_head)) {
+                auto waiter = m_head;
+                m_head = waiter->next;
+                waiter->next = nullptr;
+                *last = waiter;
+                last = &waiter->next;
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+            }
+            return granted;
+        }
+
+        std::atomic<uint32_t> m_size { 0 };
+        RWLockWaiter* m_head = nullptr;
+        RWLockWaiter* m_tail = nullptr;
+        std::mutex m_mutex;
+    };
+
+    // stands for the queue in the locks without the coroutine API
+    struct RWLockNoWaitQueue {
+        void wake() { }
+    };
+
+    // true if the mutex keeps per thread lock records, which a lock taken
+    // on behalf of another thread would corrupt
+    template <typename M, typename = void>
+    struct has_thread_detector : std::false_type {
+    };
+    template <typename M>
+    struct has_thread_detector<M, std::void_t<typename M::DeadLockDetector>>
+        : std::integral_constant<bool,
+              !std::is_same<typename M::DeadLockDetector,
+                  RWMutexNullDeadLockDetector>::value> {
+    };
+
+} // namespace detail
+
+// the state (value and mutex) lives inside the RWLock object. guards hold a
+// plain pointer to it, so the RWLock must outlive its guards.
+struct RWLockInlineStorage {
+    static constexpr bool Compact = false;
+    static constexpr bool Async = false;
+
+    template <typename State>
+    class Holder {
+    public:
+        using Handle = State*;
+
+        template <typename... Args>
+        Holder(Args&&... args)
+            : m_state(std::forward<Args>(args)...)
+        {
+        }
+        Handle handle() { return &m_state; }
+
+    private:
+        State m_state;
+    };
+};
+
+// the state is heap allocated and shared with the guards, so a guard keeps
+// the value alive after the RWLock is destroyed. costs a reference count
+// increment and decrement per lock.
+struct RWLockSharedStorage {
+    static constexpr bool Compact = false;
+    static constexpr bool Async = false;
+
+    template <typename State>
+    class Holder {
+    public:
+        using Handle = std::shared_ptr<State>;
+
+        template <typename... Args>
+        Holder(Args&&... args)
+            : m_state(std::make_shared<State>(std::forward<Args>(args)...))
+        {
+        }
+        Handle handle() { return m_state; }
+
+    private:
+        std::shared_ptr<State> m_state;
+    };
+};
+
+// like RWLockInlineStorage, but the state is only the value and the mutex,
+// side by side without padding: with a compact mutex (see
+// rwmutex-compact.h) the lock adds 4 bytes to the value. there is no room
+// for the seqlock, the version and the queues, so load() and
+// write_combined() fall back to a plain read and write lock, and version(),
+// wait_for_change(), freeze() and the coroutine API are not available.
+struct RWLockCompactStorage : RWLockInlineStorage {
+    static constexpr bool Compact = true;
+};
+
+// the given storage plus a queue of the coroutines waiting for the lock,
+// which async_read() and async_write() need. the other locks do not carry
+// the queue and do not check it on every release.
+//
+// a queued coroutine gets the lock from the thread releasing it, which
+// takes it on its behalf, and may release it on another thread: the mutex
+// must not have a per thread dead lock detector. while coroutines are
+// queued, the blocking read() and write() line up behind them, so queued
+// writers are not starved by a stream of blocking readers.
+template <typename Base = RWLockInlineStorage>
+struct RWLockAsyncStorage : Base {
+    static_assert(!Base::Compact, "the compact state has no room for the queue");
+    static constexpr bool Async = true;
+};
+
+template <typename T, typename M = hsqr::RWMutex,
+    typename Storage = RWLockInlineStorage>
 class RWLock {
-    struct State;
+    struct FullState;
+    struct CompactState;
+    using State = std::conditional_t<Storage::Compact, CompactState, FullState>;
+    using Handle = typename Storage::template Holder<State>::Handle;
+    static_assert(!Storage::Async || !detail::has_thread_detector<M>::value,
+        "the coroutine queue takes locks on behalf of other threads, use a "
+        "mutex without a per thread dead lock detector such as RWMutexUnchecked");
 
 public:
     class ReadGuard;
     class WriteGuard;
+    class UpgradableGuard;
+    template <typename Guard>
+    class Intent;
 
     RWLock()
-        : m_state(new State())
+        : m_state()
     {
     }
     ~RWLock() = default;
     RWLock(const RWLock&) = delete;
     RWLock& operator=(const RWLock&) = delete;
-    RWLock(RWLock&&) = delete;
-    RWLock& operator=(RWLock&&) = delete;
+    // moving takes the write lock of the source and moves its value into a
+    // new state. there must be no guard on the moved to lock.
+    RWLock(RWLock&& other)
+        : m_state(std::in_place, std::move(*other.write()))
+    {
+    }
+    RWLock& operator=(RWLock&& other)
+    {
+        // the two locks are taken in address order, a = std::move(b) and
+        // b = std::move(a) on two threads do not dead lock
+        if (std::less<RWLock*>()(this, &other)) {
+            auto target = write();
+            *target = std::move(*other.write());
+        } else if (this != &other) {
+            auto source = other.write();
+            *write() = std::move(*source);
+        }
+        return *this;
+    }
 
     template <typename... Args>
     RWLock(std::in_place_t p, Args&&... args)
-        : m_state(new State(p, std::forward<Args>(args)...))
+        : m_state(p, std::forward<Args>(args)...)
     {
     }
     ReadGuard read()
     {
-        return ReadGuard(m_state);
+        return ReadGuard(m_state.handle());
     }
     WriteGuard write()
     {
-        return WriteGuard(m_state);
+        return WriteGuard(m_state.handle());
+    }
+    // read access that can later be upgraded to write access without letting
+    // another writer in. only one upgradable guard at a time
+    UpgradableGuard upgradable_read()
+    {
+        return UpgradableGuard(m_state.handle());
+    }
+#ifdef HSQR_RWLOCK_COROUTINES
+    template <typename Guard, typename Executor>
+    class Awaiter;
+
+    // resumes the waiting coroutine on the thread that released the lock
+    struct InlineExecutor {
+        void operator()(std::coroutine_handle<> handle) const
+        {
+            handle.resume();
+        }
+    };
+
+    // co_await lk.async_read() takes the lock without blocking the thread: if
+    // the lock is not free the coroutine is queued and resumed once a release
+    // lets it in. executor is called with the coroutine handle instead of
+    // resuming it inline on the releasing thread. needs RWLockAsyncStorage
+    template <typename Executor = InlineExecutor>
+    Awaiter<ReadGuard, Executor> async_read(Executor executor = {})
+    {
+        static_assert(Storage::Async, "async_read() needs RWLockAsyncStorage");
+        return Awaiter<ReadGuard, Executor>(m_state.handle(), std::move(executor));
+    }
+    template <typename Executor = InlineExecutor>
+    Awaiter<WriteGuard, Executor> async_write(Executor executor = {})
+    {
+        static_assert(Storage::Async, "async_write() needs RWLockAsyncStorage");
+        return Awaiter<WriteGuard, Executor>(m_state.handle(), std::move(executor));
+    }
+#endif
+    // lock requests for lock_all(), see lock-all.h
+    Intent<ReadGuard> read_intent()
+    {
+        return Intent<ReadGuard>(m_state.handle());
+    }
+    Intent<WriteGuard> write_intent()
+    {
+        return Intent<WriteGuard>(m_state.handle());
+    }
+    // the try versions return an empty optional instead of waiting past the
+    // deadline
+    std::optional<ReadGuard> try_read()
+    {
+        auto state = m_state.handle();
+        if (!state->mutex.try_read_lock()) {
+            return std::nullopt;
+        }
+        return ReadGuard(std::move(state), std::adopt_lock);
+    }
+    template <typename Rep, typename Period>
+    std::optional<ReadGuard> try_read_for(
+        const std::chrono::duration<Rep, Period>& duration)
+    {
+        auto state = m_state.handle();
+        if (!state->mutex.try_read_lock_for(duration)) {
+            // a timed writer giving up may let the queued coroutines in
+            state->wake_waiters();
+            return std::nullopt;
+        }
+        return ReadGuard(std::move(state), std::adopt_lock);
+    }
+    template <typename Clock, typename Duration>
+    std::optional<ReadGuard> try_read_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        auto state = m_state.handle();
+        if (!state->mutex.try_read_lock_until(deadline)) {
+            // a timed writer giving up may let the queued coroutines in
+            state->wake_waiters();
+            return std::nullopt;
+        }
+        return ReadGuard(std::move(state), std::adopt_lock);
+    }
+    // on a frozen lock try_write() also fails while frozen readers remain,
+    // and the timed versions wait for them until the deadline
+    std::optional<WriteGuard> try_write()
+    {
+        auto state = m_state.handle();
+        if (!state->mutex.try_write_lock()) {
+            return std::nullopt;
+        }
+        return adopt_write(std::move(state), &NoWait);
+    }
+    template <typename Rep, typename Period>
+    std::optional<WriteGuard> try_write_for(
+        const std::chrono::duration<Rep, Period>& duration)
+    {
+        auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::ceil<detail::FutexDeadline::duration>(duration);
+        auto state = m_state.handle();
+        if (!state->mutex.try_write_lock_until(deadline)) {
+            // a timed writer giving up may let the queued coroutines in
+            state->wake_waiters();
+            return std::nullopt;
+        }
+        return adopt_write(std::move(state), &deadline);
+    }
+    template <typename Clock, typename Duration>
+    std::optional<WriteGuard> try_write_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        auto state = m_state.handle();
+        if (!state->mutex.try_write_lock_until(deadline)) {
+            // a timed writer giving up may let the queued coroutines in
+            state->wake_waiters();
+            return std::nullopt;
+        }
+        auto steadyDeadline = std::chrono::steady_clock::now()
+            + std::chrono::ceil<detail::FutexDeadline::duration>(
+                deadline - Clock::now());
+        return adopt_write(std::move(state), &steadyDeadline);
+    }
+    // copy the value without taking the lock. the copy is retried if a writer
+    // raced with it, and falls back to a read lock if writers keep racing.
+    // only for trivially copyable values.
+    T load()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+            "load() requires a trivially copyable value");
+        auto state = m_state.handle();
+        if constexpr (!Storage::Compact) {
+            for (int i = 0; i < OptimisticRetries; ++i) {
+                auto begin = state->sequence.load(std::memory_order_acquire);
+                if (begin & 1) {
+                    // a writer owns the value
+                    continue;
+                }
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type buffer;
+                std::memcpy(&buffer, &state->value, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (state->sequence.load(std::memory_order_relaxed) == begin) {
+                    return *std::launder(reinterpret_cast<T*>(&buffer));
+                }
+            }
+        }
+        return *ReadGuard(std::move(state));
+    }
+    // call fn with a consistent copy of the value, see load()
+    template <typename F>
+    auto read_optimistic(F&& fn)
+    {
+        const T value = load();
+        return std::forward<F>(fn)(value);
+    }
+    // number of write guards released so far, without taking the lock
+    uint64_t version()
+    {
+        static_assert(!Storage::Compact, "version() needs the full state");
+        return m_state.handle()->sequence.load(std::memory_order_acquire) / 2;
+    }
+    // block until a write guard is released after version last was seen,
+    // or until the timeout passes. returns the current version, last if
+    // nothing changed
+    uint64_t wait_for_change(uint64_t last)
+    {
+        static_assert(!Storage::Compact, "wait_for_change() needs the full state");
+        return m_state.handle()->wait_for_change(last, nullptr);
+    }
+    template <typename Rep, typename Period>
+    uint64_t wait_for_change(
+        uint64_t last, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        static_assert(!Storage::Compact, "wait_for_change() needs the full state");
+        auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::ceil<detail::FutexDeadline::duration>(timeout);
+        return m_state.handle()->wait_for_change(last, &deadline);
+    }
+    // switch the lock to the frozen mode, for values only written at startup
+    // or in rare reload windows. while the lock is frozen read() takes no
+    // lock: it counts the reader in the shard of its thread, in a reader
+    // indicator of the lock allocated by the first freeze(), and reads the
+    // value. threads do not share a shard line up to FrozenShards threads.
+    // the first write guard taken on a frozen lock, or thaw(), thaws it:
+    // with the write lock held it waits for the frozen readers of this lock
+    // to leave, the readers that come after it take the lock as usual.
+    //  - a thread holding a frozen read guard must not write or thaw the
+    //    lock, it would wait for itself. the dead lock detector does not see
+    //    frozen reads
+    //  - the try, timed, upgradable and coroutine reads keep taking the lock
+    //  - try_write() fails while frozen readers remain, the timed writes
+    //    wait for them until the deadline, the lock then stays frozen. a
+    //    queued coroutine writer is granted the lock once the last of them
+    //    left
+    void freeze()
+    {
+        static_assert(!Storage::Compact, "freeze() needs the full state");
+        auto state = m_state.handle();
+        state->mutex.write_lock();
+        state->freeze();
+        state->mutex.write_unlock();
+        state->wake_waiters();
+    }
+    // back to locked reads, waits for the frozen readers to leave
+    void thaw()
+    {
+        static_assert(!Storage::Compact, "thaw() needs the full state");
+        auto state = m_state.handle();
+        state->mutex.write_lock();
+        state->thaw();
+        state->mutex.write_unlock();
+        state->wake_waiters();
+    }
+    bool frozen()
+    {
+        static_assert(!Storage::Compact, "frozen() needs the full state");
+        return m_state.handle()->frozen.load();
+    }
+    // call fn(T&) under the write lock, batched with the concurrent calls of
+    // other threads: every caller publishes its call in a slot of the lock,
+    // and one of them, the combiner, takes the write lock once and runs all
+    // the published calls. returns what fn returned or rethrows what it
+    // threw. fn may run on another thread and must not use this lock.
+    template <typename F>
+    auto write_combined(F&& fn) -> std::invoke_result_t<F&, T&>
+    {
+        using Call = CombinedCall<std::remove_reference_t<F>>;
+        static_assert(!std::is_reference<typename Call::Result>::value,
+            "write_combined can not return a reference");
+        auto state = m_state.handle();
+        if constexpr (Storage::Compact) {
+            WriteGuard guard(std::move(state));
+            return fn(*guard);
+        } else {
+            auto& combining = state->combining();
+            Call call(fn);
+            if (!publish(combining, &call)) {
+                // every slot is taken
+                WriteGuard guard(std::move(state));
+                return fn(*guard);
+            }
+            while (call.status.load(std::memory_order_acquire) != CombinedWrite::Done) {
+                if (!combining.busy.exchange(true)
+                    || wait(call) == CombinedWrite::Combine) {
+                    combine(state, combining);
+                }
+            }
+            return call.get();
+        }
     }
 
     class ReadGuard {
     public:
-        ReadGuard(std::shared_ptr<State> state)
-            : m_state(state)
+        ReadGuard(Handle state)
+            : m_state(std::move(state))
+        {
+            lock();
+        }
+        // the read lock is already held
+        ReadGuard(Handle state, std::adopt_lock_t)
+            : m_state(std::move(state))
         {
-            m_state->mutex.read_lock();
         }
         ~ReadGuard()
         {
-            m_state->mutex.read_unlock();
+            if (m_state) {
+                unlock();
+            }
         }
         ReadGuard(const ReadGuard&) = delete;
         ReadGuard& operator=(const ReadGuard&) const = delete;
 
-        ReadGuard(ReadGuard&&) = default;
-        ReadGuard& operator=(ReadGuard&&) = default;
+        ReadGuard(ReadGuard&& other) noexcept
+            : m_state(std::exchange(other.m_state, nullptr))
+            , m_frozen(other.m_frozen)
+        {
+        }
+        ReadGuard& operator=(ReadGuard&& other) noexcept
+        {
+            if (this != &other) {
+                if (m_state) {
+                    unlock();
+                }
+                m_state = std::exchange(other.m_state, nullptr);
+                m_frozen = other.m_frozen;
+            }
+            return *this;
+        }
 
         const T& operator*() const
         {
@@ -68,25 +564,68 @@ public:
         }
 
     private:
-        std::shared_ptr<State> m_state;
+        // RWConditionVariable releases and takes the lock back while waiting
+        friend class hsqr::RWConditionVariable;
+        static constexpr bool Write = false;
+
+        void lock()
+        {
+            m_frozen = m_state->frozen_read_lock();
+            if (!m_frozen) {
+                m_state->read_lock();
+            }
+        }
+        void unlock()
+        {
+            if (m_frozen) {
+                m_state->frozen_read_unlock();
+            } else {
+                m_state->mutex.read_unlock();
+                m_state->wake_waiters();
+            }
+        }
+
+        Handle m_state;
+        // read of a frozen lock, the mutex is not held
+        bool m_frozen = false;
     };
 
     class WriteGuard {
     public:
-        WriteGuard(std::shared_ptr<State> state)
-            : m_state(state)
+        WriteGuard(Handle state)
+            : m_state(std::move(state))
+        {
+            lock();
+        }
+        // the write lock is already held
+        WriteGuard(Handle state, std::adopt_lock_t)
+            : m_state(std::move(state))
         {
-            m_state->mutex.write_lock();
+            m_state->begin_write();
         }
         ~WriteGuard()
         {
-            m_state->mutex.write_unlock();
+            if (m_state) {
+                unlock();
+            }
         }
         WriteGuard(const WriteGuard&) = delete;
         WriteGuard& operator=(const WriteGuard&) const = delete;
 
-        WriteGuard(WriteGuard&&) = default;
-        WriteGuard& operator=(WriteGuard&&) = default;
+        WriteGuard(WriteGuard&& other) noexcept
+            : m_state(std::exchange(other.m_state, nullptr))
+        {
+        }
+        WriteGuard& operator=(WriteGuard&& other) noexcept
+        {
+            if (this != &other) {
+                if (m_state) {
+                    unlock();
+                }
+                m_state = std::exchange(other.m_state, nullptr);
+            }
+            return *this;
+        }
 
         T& operator*()
         {
@@ -98,27 +637,632 @@ public:
             return m_state->value;
         }
 
+        // keep read access, other readers can get in but no writer
+        ReadGuard downgrade() &&
+        {
+            m_state->end_write();
+            m_state->mutex.downgrade();
+            m_state->wake_waiters();
+            return ReadGuard(std::exchange(m_state, nullptr), std::adopt_lock);
+        }
+
     private:
-        std::shared_ptr<State> m_state;
+        friend class hsqr::RWConditionVariable;
+        static constexpr bool Write = true;
+
+        void lock()
+        {
+            m_state->write_lock();
+            m_state->begin_write();
+        }
+        void unlock()
+        {
+            m_state->end_write();
+            m_state->mutex.write_unlock();
+            m_state->wake_waiters();
+        }
+
+        Handle m_state;
+    };
+
+    class UpgradableGuard {
+    public:
+        UpgradableGuard(Handle state)
+            : m_state(std::move(state))
+        {
+            m_state->mutex.upgradable_lock();
+        }
+        ~UpgradableGuard()
+        {
+            if (m_state) {
+                m_state->mutex.upgradable_unlock();
+                m_state->wake_waiters();
+            }
+        }
+        UpgradableGuard(const UpgradableGuard&) = delete;
+        UpgradableGuard& operator=(const UpgradableGuard&) const = delete;
+
+        UpgradableGuard(UpgradableGuard&& other) noexcept
+            : m_state(std::exchange(other.m_state, nullptr))
+        {
+        }
+        UpgradableGuard& operator=(UpgradableGuard&& other) noexcept
+        {
+            if (this != &other) {
+                if (m_state) {
+                    m_state->mutex.upgradable_unlock();
+                    m_state->wake_waiters();
+                }
+                m_state = std::exchange(other.m_state, nullptr);
+            }
+            return *this;
+        }
+
+        const T& operator*() const
+        {
+            return m_state->value;
+        }
+
+        // wait for the readers to leave and take write access. the value
+        // can not change between the read and the write
+        WriteGuard upgrade() &&
+        {
+            m_state->mutex.upgrade();
+            return WriteGuard(std::exchange(m_state, nullptr), std::adopt_lock);
+        }
+
+    private:
+        Handle m_state;
+    };
+
+    // a lock that lock_all() takes, then turns into a guard
+    template <typename Guard>
+    class Intent {
+    public:
+        using guard_type = Guard;
+        static constexpr bool Write = std::is_same<Guard, WriteGuard>::value;
+
+        explicit Intent(Handle state)
+            : m_state(std::move(state))
+        {
+        }
+        const void* lock_address() const
+        {
+            return &m_state->mutex;
+        }
+        void lock()
+        {
+            if constexpr (Write) {
+                m_state->write_lock();
+            } else {
+                m_state->read_lock();
+            }
+        }
+        void unlock()
+        {
+            if constexpr (Write) {
+                m_state->mutex.write_unlock();
+            } else {
+                m_state->mutex.read_unlock();
+            }
+            m_state->wake_waiters();
+        }
+        // the lock must be held
+        Guard adopt()
+        {
+            return Guard(std::move(m_state), std::adopt_lock);
+        }
+
+    private:
+        Handle m_state;
+    };
+
+#ifdef HSQR_RWLOCK_COROUTINES
+    template <typename Guard, typename Executor>
+    class Awaiter : detail::RWLockWaiter {
+    public:
+        Awaiter(Handle state, Executor executor)
+            : m_state(std::move(state))
+            , m_executor(std::move(executor))
+        {
+            this->try_lock = &Awaiter::try_lock_for;
+            this->resume = &Awaiter::resume_for;
+        }
+        Awaiter(const Awaiter&) = delete;
+        Awaiter& operator=(const Awaiter&) = delete;
+
+        // behind the queued waiters if there are any, like the blocking locks
+        bool await_ready()
+        {
+            return m_state->waiters.empty() && try_lock_for(this);
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            return m_state->waiters.push(this);
+        }
+        Guard await_resume()
+        {
+            return Guard(std::move(m_state), std::adopt_lock);
+        }
+
+    private:
+        // runs on the thread granting the lock, which must not wait for the
+        // frozen readers: the last of them to leave retries the queue
+        static bool try_lock_for(detail::RWLockWaiter* waiter)
+        {
+            auto& state = *static_cast<Awaiter*>(waiter)->m_state;
+            if constexpr (std::is_same<Guard, WriteGuard>::value) {
+                if (!state.mutex.try_write_lock()) {
+                    return false;
+                }
+                if (!state.thaw(&NoWait, FrozenReaders::QueueWaits)) {
+                    state.mutex.write_unlock();
+                    return false;
+                }
+                return true;
+            } else {
+                return state.mutex.try_read_lock();
+            }
+        }
+        static void resume_for(detail::RWLockWaiter* waiter)
+        {
+            auto self = static_cast<Awaiter*>(waiter);
+            self->m_executor(self->m_handle);
+        }
+
+        Handle m_state;
+        Executor m_executor;
+        std::coroutine_handle<> m_handle;
     };
+#endif
 
 private:
-    struct State {
-        State()
+    static constexpr int OptimisticRetries = 16;
+    static constexpr std::size_t CombiningSlots = 16;
+    // a combiner hands over to a waiting caller after this many batches
+    static constexpr int CombiningBatches = 8;
+    static constexpr int CombiningSpins = 1024;
+    static constexpr std::size_t FrozenShards = 16;
+    // a deadline already passed, the thaw of a try lock does not wait
+    static constexpr detail::FutexDeadline NoWait = detail::FutexDeadline::min();
+
+    // the write lock is held: thaw the lock by the deadline, or release the
+    // lock and give up
+    static std::optional<WriteGuard> adopt_write(
+        Handle state, const detail::FutexDeadline* deadline)
+    {
+        if (!state->thaw(deadline)) {
+            state->mutex.write_unlock();
+            state->wake_waiters();
+            return std::nullopt;
+        }
+        return WriteGuard(std::move(state), std::adopt_lock);
+    }
+
+    // a write_combined call, lives on the stack of the caller until the
+    // combiner marked it done
+    struct CombinedWrite {
+        enum : uint32_t {
+            Waiting,
+            // the caller sleeps on the status word
+            Parked,
+            Done,
+            // the caller takes over as combiner
+            Combine
+        };
+        void (*apply)(CombinedWrite*, T&);
+        std::atomic<uint32_t> status { Waiting };
+        std::exception_ptr error;
+    };
+    template <typename F>
+    struct CombinedCall : CombinedWrite {
+        using Result = std::invoke_result_t<F&, T&>;
+
+        CombinedCall(F& f)
+            : fn(&f)
+        {
+            this->apply = &CombinedCall::apply_call;
+        }
+        static void apply_call(CombinedWrite* write, T& value)
+        {
+            auto self = static_cast<CombinedCall*>(write);
+            try {
+                if constexpr (std::is_void<Result>::value) {
+                    (*self->fn)(value);
+                } else {
+                    self->result.emplace((*self->fn)(value));
+                }
+            } catch (...) {
+                self->error = std::current_exception();
+            }
+        }
+        Result get()
+        {
+            if (this->error) {
+                std::rethrow_exception(this->error);
+            }
+            if constexpr (!std::is_void<Result>::value) {
+                return std::move(*result);
+            }
+        }
+
+        F* fn;
+        std::optional<std::conditional_t<std::is_void<Result>::value, bool, Result>>
+            result;
+    };
+    // allocated by the first write_combined call on the lock
+    struct Combining {
+        struct alignas(detail::CacheLineSize) Slot {
+            std::atomic<CombinedWrite*> write { nullptr };
+        };
+        alignas(detail::CacheLineSize) std::atomic<bool> busy { false };
+        Slot slots[CombiningSlots];
+    };
+
+    // the frozen readers of a lock, allocated by its first freeze(). every
+    // thread counts itself in its own shard, the count of a shard may go
+    // negative if a guard is released on another thread, only the sum
+    // matters
+    struct FrozenReaders {
+        struct alignas(detail::CacheLineSize) Shard {
+            std::atomic<uint64_t> count { 0 };
+        };
+
+        std::atomic<uint64_t>& shard()
+        {
+            return shards[detail::thread_index() % FrozenShards].count;
+        }
+        uint64_t count() const
+        {
+            uint64_t sum = 0;
+            for (auto& shard : shards) {
+                sum += shard.count.load();
+            }
+            return sum;
+        }
+
+        Shard shards[FrozenShards];
+        enum : uint32_t {
+            // a thread thaws, the readers leaving bump departures
+            ThreadWaits = 1,
+            // a queued coroutine writer waits, the readers leaving retry
+            // the queue
+            QueueWaits = 2
+        };
+        alignas(detail::CacheLineSize) std::atomic<uint32_t> waiting { 0 };
+        std::atomic<uint32_t> departures { 0 };
+    };
+
+    static bool publish(Combining& combining, CombinedWrite* write)
+    {
+        auto start = detail::thread_index();
+        for (std::size_t i = 0; i < CombiningSlots; ++i) {
+            CombinedWrite* expected = nullptr;
+            if (combining.slots[(start + i) % CombiningSlots].write
+                    .compare_exchange_strong(expected, write)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    static CombinedWrite* pending(Combining& combining)
+    {
+        for (auto& slot : combining.slots) {
+            if (auto write = slot.write.load()) {
+                return write;
+            }
+        }
+        return nullptr;
+    }
+    static void complete(CombinedWrite* write, uint32_t status)
+    {
+        auto word = detail::futex_word(write->status);
+        // the caller may return as soon as it sees the new status, the word
+        // is only used as a futex address after that
+        if (write->status.exchange(status, std::memory_order_acq_rel)
+            == CombinedWrite::Parked) {
+            detail::futex_wake(word, 1);
+        }
+    }
+    // spin then sleep until the call is done or the caller has to combine
+    static uint32_t wait(CombinedWrite& write)
+    {
+        for (int i = 0; i < CombiningSpins; ++i) {
+            auto status = write.status.load(std::memory_order_acquire);
+            if (status != CombinedWrite::Waiting) {
+                return status;
+            }
+            detail::cpu_relax();
+        }
+        uint32_t status = CombinedWrite::Waiting;
+        if (!write.status.compare_exchange_strong(status, CombinedWrite::Parked,
+                std::memory_order_acquire)) {
+            return status;
+        }
+        while ((status = write.status.load(std::memory_order_acquire))
+            == CombinedWrite::Parked) {
+            detail::futex_wait(detail::futex_word(write.status),
+                CombinedWrite::Parked);
+        }
+        return status;
+    }
+    // run the published calls in batches, one write lock per batch. the
+    // combiner keeps going while calls are published, then clears the busy
+    // flag and checks the slots again: a caller that published after the
+    // last batch either sees the flag clear or is seen by the check
+    void combine(const Handle& state, Combining& combining)
+    {
+        for (int batch = 1;; ++batch) {
+            {
+                WriteGuard guard(state);
+                for (auto& slot : combining.slots) {
+                    if (auto write = slot.write.load(std::memory_order_acquire)) {
+                        slot.write.store(nullptr, std::memory_order_relaxed);
+                        write->apply(write, *guard);
+                        complete(write, CombinedWrite::Done);
+                    }
+                }
+            }
+            auto next = pending(combining);
+            if (next == nullptr) {
+                combining.busy.store(false);
+                if (pending(combining) == nullptr || combining.busy.exchange(true)) {
+                    return;
+                }
+            } else if (batch >= CombiningBatches) {
+                // the busy flag goes to the waiting caller
+                complete(next, CombinedWrite::Combine);
+                return;
+            }
+        }
+    }
+
+    // a thread that lines up behind the queued coroutines, see
+    // RWLockAsyncStorage. it sleeps until a release took the lock for it
+    template <bool Write>
+    struct ThreadWaiter : detail::RWLockWaiter {
+        explicit ThreadWaiter(M& mutex)
+            : mutex(mutex)
+        {
+            this->try_lock = &ThreadWaiter::try_lock_for;
+            this->resume = &ThreadWaiter::resume_for;
+        }
+        static bool try_lock_for(detail::RWLockWaiter* waiter)
+        {
+            auto& mutex = static_cast<ThreadWaiter*>(waiter)->mutex;
+            if constexpr (Write) {
+                return mutex.try_write_lock();
+            } else {
+                return mutex.try_read_lock();
+            }
+        }
+        static void resume_for(detail::RWLockWaiter* waiter)
+        {
+            auto self = static_cast<ThreadWaiter*>(waiter);
+            auto word = detail::futex_word(self->granted);
+            // the thread may return as soon as it sees the flag
+            self->granted.store(1, std::memory_order_release);
+            detail::futex_wake(word, 1);
+        }
+        void wait()
+        {
+            while (granted.load(std::memory_order_acquire) == 0) {
+                detail::futex_wait(detail::futex_word(granted), 0);
+            }
+        }
+
+        M& mutex;
+        std::atomic<uint32_t> granted { 0 };
+    };
+
+    // the value and the mutex are on separate cache lines so readers bumping
+    // the mutex counter do not invalidate the line holding the value
+    struct FullState {
+        FullState()
             : value()
         {
         }
         template <typename... Args>
-        State(std::in_place_t, Args&&... args)
+        FullState(std::in_place_t, Args&&... args)
             : value(std::forward<Args>(args)...)
         {
         }
+        ~FullState()
+        {
+            delete combiningSlots.load();
+            delete frozenReaders.load();
+        }
+        // blocking locks, behind the queued coroutines if there are any
+        void read_lock()
+        {
+            if constexpr (Storage::Async) {
+                if (!waiters.empty()) {
+                    wait_in_line<false>();
+                    return;
+                }
+            }
+            mutex.read_lock();
+        }
+        void write_lock()
+        {
+            if constexpr (Storage::Async) {
+                if (!waiters.empty()) {
+                    wait_in_line<true>();
+                    return;
+                }
+            }
+            mutex.write_lock();
+        }
+        template <bool Write>
+        void wait_in_line()
+        {
+            ThreadWaiter<Write> waiter(mutex);
+            if (waiters.push(&waiter)) {
+                waiter.wait();
+            }
+        }
+        void wake_waiters()
+        {
+            waiters.wake();
+        }
+        // needs the write lock. the reader indicator is kept until the
+        // state is destroyed, a frozen reader may still hold a pointer to it
+        void freeze()
+        {
+            if (frozenReaders.load(std::memory_order_relaxed) == nullptr) {
+                frozenReaders.store(new FrozenReaders(), std::memory_order_release);
+            }
+            frozen.store(true);
+        }
+        // a frozen reader counts itself in, then checks the flag again: a
+        // thaw either sees the count or is seen by the check
+        bool frozen_read_lock()
+        {
+            auto readers = frozenReaders.load(std::memory_order_acquire);
+            if (readers == nullptr || !frozen.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            readers->shard().fetch_add(1);
+            if (frozen.load()) {
+                return true;
+            }
+            frozen_read_unlock();
+            return false;
+        }
+        void frozen_read_unlock()
+        {
+            auto& readers = *frozenReaders.load(std::memory_order_relaxed);
+            readers.shard().fetch_sub(1);
+            if (auto waiting = readers.waiting.load()) {
+                if (waiting & FrozenReaders::ThreadWaits) {
+                    readers.departures.fetch_add(1);
+                    detail::futex_wake(detail::futex_word(readers.departures), 1);
+                }
+                if (waiting & FrozenReaders::QueueWaits) {
+                    wake_waiters();
+                }
+            }
+        }
+        // needs the write lock. waits for the frozen readers of this lock to
+        // leave, forever without a deadline. if they are still there at the
+        // deadline the lock is frozen again and false is returned, the
+        // waiter stays registered for a queued coroutine
+        bool thaw(const detail::FutexDeadline* deadline = nullptr,
+            uint32_t waiter = FrozenReaders::ThreadWaits)
+        {
+            if (!frozen.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            auto& readers = *frozenReaders.load(std::memory_order_relaxed);
+            frozen.store(false);
+            readers.waiting.fetch_or(waiter);
+            while (true) {
+                auto departures = readers.departures.load();
+                if (readers.count() == 0) {
+                    readers.waiting.store(0);
+                    return true;
+                }
+                if (deadline != nullptr && std::chrono::steady_clock::now() >= *deadline) {
+                    break;
+                }
+                detail::futex_wait(detail::futex_word(readers.departures), departures,
+                    detail::FutexWaitAny, deadline);
+            }
+            frozen.store(true);
+            if (waiter == FrozenReaders::ThreadWaits) {
+                readers.waiting.fetch_and(~waiter);
+            }
+            return false;
+        }
+        // seqlock for load(), also the version: odd while a writer owns the
+        // value, twice the version otherwise. only the writer holding the
+        // mutex modifies it
+        void begin_write()
+        {
+            thaw();
+            sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        void end_write()
+        {
+            // a read-modify-write so the check of the waiters below can not
+            // be ordered before it
+            sequence.fetch_add(1);
+            if (versionWaiters.load() != 0) {
+                detail::futex_wake(detail::futex_low_word(sequence));
+            }
+        }
+        uint64_t wait_for_change(uint64_t last, const detail::FutexDeadline* deadline)
+        {
+            versionWaiters.fetch_add(1);
+            auto current = sequence.load();
+            while (current / 2 == last) {
+                if (deadline != nullptr && std::chrono::steady_clock::now() >= *deadline) {
+                    break;
+                }
+                detail::futex_wait(detail::futex_low_word(sequence),
+                    static_cast<uint32_t>(current), detail::FutexWaitAny, deadline);
+                current = sequence.load();
+            }
+            versionWaiters.fetch_sub(1, std::memory_order_relaxed);
+            return current / 2;
+        }
+        Combining& combining()
+        {
+            auto combining = combiningSlots.load(std::memory_order_acquire);
+            if (combining == nullptr) {
+                auto fresh = new Combining();
+                if (combiningSlots.compare_exchange_strong(combining, fresh)) {
+                    combining = fresh;
+                } else {
+                    delete fresh;
+                }
+            }
+            return *combining;
+        }
+
+        alignas(detail::CacheLineSize) alignas(T) T value;
+        alignas(detail::CacheLineSize) M mutex;
+        // next to the mutex, which a reader touches anyway. only written by
+        // freeze() and thaw(), the line stays shared while the lock is frozen
+        std::atomic<bool> frozen { false };
+        std::atomic<uint64_t> sequence { 0 };
+        // threads in wait_for_change()
+        std::atomic<uint32_t> versionWaiters { 0 };
+        std::conditional_t<Storage::Async, detail::RWLockWaitQueue,
+            detail::RWLockNoWaitQueue>
+            waiters;
+        std::atomic<Combining*> combiningSlots { nullptr };
+        std::atomic<FrozenReaders*> frozenReaders { nullptr };
+    };
+    // see RWLockCompactStorage
+    struct CompactState {
+        CompactState()
+            : value()
+        {
+        }
+        template <typename... Args>
+        CompactState(std::in_place_t, Args&&... args)
+            : value(std::forward<Args>(args)...)
+        {
+        }
+        void read_lock() { mutex.read_lock(); }
+        void write_lock() { mutex.write_lock(); }
+        bool frozen_read_lock() { return false; }
+        void frozen_read_unlock() { }
+        bool thaw(const detail::FutexDeadline*) { return true; }
+        void begin_write() { }
+        void end_write() { }
+        void wake_waiters() { }
+
         T value;
         M mutex;
     };
-    std::shared_ptr<State> m_state;
+    typename Storage::template Holder<State> m_state;
 };
 
 } // namespace
 
-#endif // HSQR_RWLOCK_H_
\ No newline at end of file
+#endif // HSQR_RWLOCK_H_
@@ -0,0 +1,126 @@
+#ifndef HSQR_RWMUTEX_BACKOFF_H_
+#define HSQR_RWMUTEX_BACKOFF_H_
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+// backoff policies of RWMutexImpl. every acquisition creates a Spinner with
+// start(), then the mutex calls:
+//  - collided(spinner) after a compare and swap on the state word failed,
+//    before it retries
+//  - spin(spinner) when it would park. returns true if the thread should
+//    re-check the state instead of parking, after pausing for a while
+//  - acquired(spinner) once the lock was taken
+// start() and collided() are also used by the unlock retry loops.
+
+// never spins, a blocked thread parks right away and a failed compare and
+// swap is retried immediately
+class RWMutexNoBackoff {
+public:
+    struct Spinner {
+    };
+    Spinner start() { return {}; }
+    void collided(Spinner&) { }
+    bool spin(Spinner&) { return false; }
+    void acquired(const Spinner&) { }
+};
+
+// spins before parking, pausing with exponential backoff. the spin budget of
+// the mutex follows the recent hold times: a thread that got the lock after
+// spinning n pause units moves the budget toward 2n, a thread that spun the
+// whole budget and parked shrinks it. the budget stays in [MinSpin, MaxSpin]
+// pause units; a single pause never exceeds MaxPause units. a failed compare
+// and swap backs off the same way, so heavy contention on the state word does
+// not turn into a retry storm.
+template <uint32_t MinSpin = 16, uint32_t MaxSpin = 4096, uint32_t MaxPause = 64>
+class RWMutexAdaptiveBackoffImpl {
+    static_assert(MinSpin > 0 && MinSpin <= MaxSpin, "invalid spin budget");
+    static_assert(MaxPause > 0, "invalid pause");
+
+public:
+    struct Spinner {
+        uint32_t spun = 0;
+        uint32_t pause = 1;
+        // loaded on the first spin, most acquisitions never need it
+        uint32_t budget = 0;
+        bool parked = false;
+    };
+
+    RWMutexAdaptiveBackoffImpl() = default;
+    RWMutexAdaptiveBackoffImpl(const RWMutexAdaptiveBackoffImpl&) = delete;
+    RWMutexAdaptiveBackoffImpl& operator=(const RWMutexAdaptiveBackoffImpl&) = delete;
+    RWMutexAdaptiveBackoffImpl(RWMutexAdaptiveBackoffImpl&&) = delete;
+    RWMutexAdaptiveBackoffImpl& operator=(RWMutexAdaptiveBackoffImpl&&) = delete;
+
+    Spinner start() { return {}; }
+    void collided(Spinner& spinner)
+    {
+        backoff(spinner);
+    }
+    bool spin(Spinner& spinner)
+    {
+        if (spinner.budget == 0) {
+            spinner.budget = m_budget.load(std::memory_order_relaxed);
+        }
+        if (spinner.parked || spinner.spun >= spinner.budget) {
+            spinner.parked = true;
+            return false;
+        }
+        backoff(spinner);
+        return true;
+    }
+    void acquired(const Spinner& spinner)
+    {
+        if (spinner.budget == 0) {
+            // did not have to wait
+            return;
+        }
+        int64_t budget = spinner.budget;
+        int64_t target = spinner.parked
+            ? budget - budget / 8
+            : budget + (2 * int64_t(spinner.spun) - budget) / 8;
+        if (target < MinSpin) {
+            target = MinSpin;
+        } else if (target > MaxSpin) {
+            target = MaxSpin;
+        }
+        if (target != budget) {
+            m_budget.store(static_cast<uint32_t>(target), std::memory_order_relaxed);
+        }
+    }
+
+    // current spin budget in pause units
+    uint32_t budget() const
+    {
+        return m_budget.load(std::memory_order_relaxed);
+    }
+
+private:
+    static void backoff(Spinner& spinner)
+    {
+        for (uint32_t i = 0; i < spinner.pause; ++i) {
+            detail::cpu_relax();
+        }
+        spinner.spun += spinner.pause;
+        if (spinner.pause < MaxPause) {
+            spinner.pause *= 2;
+        }
+    }
+
+    // start in the middle, so the budget can move either way
+    static constexpr uint32_t InitialSpin = MaxSpin / 16 > MinSpin ? MaxSpin / 16 : MinSpin;
+
+    std::atomic<uint32_t> m_budget { InitialSpin };
+};
+
+using RWMutexAdaptiveBackoff = RWMutexAdaptiveBackoffImpl<>;
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_BACKOFF_H_
@@ -0,0 +1,271 @@
+#ifndef HSQR_RWMUTEX_COHORT_H_
+#define HSQR_RWMUTEX_COHORT_H_
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
+#include "hsqr/rwmutex.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWMutexCohortDiag;
+};
+
+namespace detail {
+
+    // NUMA node the calling thread runs on, 0 if unknown
+    inline std::size_t current_numa_node()
+    {
+#if defined(__linux__) && defined(SYS_getcpu)
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+            return node;
+        }
+#endif
+        return 0;
+    }
+
+    // node of the calling thread, sampled on first use. a thread keeps its
+    // node for its whole life even if the scheduler moves it, so a read
+    // unlock always finds the indicator its read lock incremented
+    inline std::size_t& thread_numa_node()
+    {
+        thread_local static std::size_t node = current_numa_node();
+        return node;
+    }
+
+} // namespace detail
+
+// NUMA aware reader writer lock, built with lock cohorting:
+//  - readers count themselves in a per node, cache line padded indicator,
+//    so reader traffic stays inside the node
+//  - a writer takes the lock of its node, then the global lock. on unlock,
+//    if another writer of the same node waits, the global lock is passed to
+//    it without being released, so the lock and the data it protects stay
+//    in the caches of one node. after MaxLocalHandoffs consecutive handoffs
+//    the global lock is released, so remote writers and the readers get in.
+//    a released global lock goes to whichever writer takes it first, the
+//    waiting writers are not served in order
+// writers have precedence over readers: a reader waits while the global
+// lock is held. nodes above MaxNodes share indicators.
+//
+// a thread always uses the same node indicator, so a read lock must be
+// released by the thread that took it.
+template <typename DeadLockDetector_T, std::size_t MaxNodes = 8,
+    uint32_t MaxLocalHandoffs = 64>
+class RWMutexCohortImpl {
+    friend struct hsqr::test::RWMutexCohortDiag;
+
+public:
+    using DeadLockDetector = DeadLockDetector_T;
+
+    RWMutexCohortImpl() noexcept
+        : m_deadlockDetector(this)
+    {
+    }
+    ~RWMutexCohortImpl() noexcept
+    {
+#ifndef NDEBUG
+        for (auto& node : m_nodes) {
+            assert(node.readers.load() == 0);
+            assert(node.lock.load() == Free);
+        }
+#endif
+        assert(m_global.load() == Free);
+    }
+
+    RWMutexCohortImpl(const RWMutexCohortImpl&) = delete;
+    RWMutexCohortImpl& operator=(const RWMutexCohortImpl&) = delete;
+    RWMutexCohortImpl(RWMutexCohortImpl&&) = delete;
+    RWMutexCohortImpl& operator=(RWMutexCohortImpl&&) = delete;
+
+    // increment the node indicator, back off and wait if a writer holds the
+    // global lock
+    void read_lock()
+    {
+        if (m_deadlockDetector.can_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+
+        auto& readers = m_nodes[node_index()].readers;
+        while (true) {
+            readers.fetch_add(1);
+            if (m_global.load() == Free) {
+                m_deadlockDetector.read_locked();
+                break;
+            }
+            if (readers.fetch_sub(1) == 1) {
+                notify_writer();
+            }
+            wait_global();
+        }
+    }
+    // decrement the node indicator, notify the writer if it drained
+    void read_unlock()
+    {
+        auto& readers = m_nodes[node_index()].readers;
+        auto count = readers.load(std::memory_order_relaxed);
+        do {
+            if (count == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+        } while (!readers.compare_exchange_weak(count, count - 1));
+        m_deadlockDetector.read_unlocked();
+        if (count == 1 && m_global.load() != Free) {
+            notify_writer();
+        }
+    }
+    // take the node lock, then the global lock unless the previous owner of
+    // the node lock passed it over, then wait for the readers of all nodes
+    void write_lock()
+    {
+        if (m_deadlockDetector.can_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+
+        auto index = node_index();
+        auto& node = m_nodes[index];
+        node.waiting.fetch_add(1);
+        lock_word(node.lock, detail::FutexWaitAny);
+        node.waiting.fetch_sub(1);
+        if (node.globalPassed) {
+            node.globalPassed = false;
+        } else {
+            lock_word(m_global, detail::FutexWaitWriters);
+        }
+        m_owner = index;
+        m_deadlockDetector.write_locked();
+
+        while (true) {
+            auto drain = m_drain.load();
+            if (drained()) {
+                break;
+            }
+            detail::futex_wait(detail::futex_word(m_drain), drain);
+        }
+    }
+    // pass the global lock to a writer of the same node if one waits and the
+    // handoff budget allows it, otherwise release it
+    void write_unlock()
+    {
+        if (m_global.load(std::memory_order_relaxed) == Free) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        auto& node = m_nodes[m_owner];
+        m_deadlockDetector.write_unlocked();
+        if (node.waiting.load() != 0 && node.handoffs < MaxLocalHandoffs) {
+            ++node.handoffs;
+            node.globalPassed = true;
+        } else {
+            node.handoffs = 0;
+            if (m_global.exchange(Free, std::memory_order_release) == Parked) {
+                detail::futex_wake(detail::futex_word(m_global), INT_MAX,
+                    detail::FutexWaitReaders);
+                detail::futex_wake(detail::futex_word(m_global), 1,
+                    detail::FutexWaitWriters);
+            }
+        }
+        if (node.lock.exchange(Free, std::memory_order_release) == Parked) {
+            detail::futex_wake(detail::futex_word(node.lock), 1);
+        }
+    }
+
+private:
+    enum : uint32_t { Free,
+        Locked,
+        Parked };
+
+    struct alignas(detail::CacheLineSize) Node {
+        std::atomic<uint32_t> readers { 0 };
+        // the writer side is on its own line, a writer spinning on the node
+        // lock does not disturb the readers of the node
+        alignas(detail::CacheLineSize) std::atomic<uint32_t> lock { Free };
+        // writers that want the node lock
+        std::atomic<uint32_t> waiting { 0 };
+        // protected by the node lock
+        bool globalPassed = false;
+        uint32_t handoffs = 0;
+    };
+
+    static std::size_t node_index()
+    {
+        return detail::thread_numa_node() % MaxNodes;
+    }
+    // futex mutex, Parked means someone may sleep on the word
+    static void lock_word(std::atomic<uint32_t>& word, uint32_t wakeMask)
+    {
+        uint32_t state = Free;
+        if (word.compare_exchange_strong(state, Locked)) {
+            return;
+        }
+        if (state != Parked) {
+            state = word.exchange(Parked);
+        }
+        while (state != Free) {
+            detail::futex_wait(detail::futex_word(word), Parked, wakeMask);
+            state = word.exchange(Parked);
+        }
+    }
+    void wait_global()
+    {
+        auto state = m_global.load();
+        while (state != Free) {
+            if (state == Parked || m_global.compare_exchange_weak(state, Parked)) {
+                detail::futex_wait(detail::futex_word(m_global), Parked,
+                    detail::FutexWaitReaders);
+                state = m_global.load();
+            }
+        }
+    }
+    bool drained() const
+    {
+        for (auto& node : m_nodes) {
+            if (node.readers.load() != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void notify_writer()
+    {
+        m_drain.fetch_add(1);
+        detail::futex_wake(detail::futex_word(m_drain), 1);
+    }
+
+    Node m_nodes[MaxNodes];
+    alignas(detail::CacheLineSize) std::atomic<uint32_t> m_global { Free };
+    std::atomic<uint32_t> m_drain { 0 };
+    // node of the writer holding the lock
+    std::size_t m_owner = 0;
+    DeadLockDetector_T m_deadlockDetector;
+};
+
+using RWMutexCohortUnchecked = RWMutexCohortImpl<RWMutexNullDeadLockDetector>;
+using RWMutexCohortChecked = RWMutexCohortImpl<RWMutexDeadLockDetector>;
+
+#ifndef NDEBUG
+using RWMutexCohort = RWMutexCohortChecked;
+#else
+using RWMutexCohort = RWMutexCohortUnchecked;
+#endif
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_COHORT_H_
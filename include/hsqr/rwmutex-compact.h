@@ -0,0 +1,355 @@
+#ifndef HSQR_RWMUTEX_COMPACT_H_
+#define HSQR_RWMUTEX_COMPACT_H_
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
+#include "hsqr/rwmutex.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWMutexCompactDiag;
+};
+
+// reader writer lock whose whole state is one 32 bit word, for a lock per
+// entry in large tables. threads block with a futex on the word itself:
+//  bits  0..27 number of readers holding the lock
+//  bit      28 a writer owns the lock
+//  bit      29 a writer claimed the lock and waits for the readers to leave,
+//              new readers wait
+//  bit      30 readers sleep on the word
+//  bit      31 writers sleep on the word
+// a blocked thread spins for a short while, then parks. a write unlock wakes
+// every parked thread, readers and writers then race for the lock: there is
+// no queue and no fairness policy, and no upgradable lock.
+//
+// the dead lock detector is a private base, the empty unchecked one takes no
+// space: sizeof(RWMutexCompactUnchecked) is 4.
+template <typename DeadLockDetector_T>
+class RWMutexCompactImpl : private DeadLockDetector_T {
+    friend struct hsqr::test::RWMutexCompactDiag;
+
+public:
+    using DeadLockDetector = DeadLockDetector_T;
+
+    RWMutexCompactImpl() noexcept
+        : DeadLockDetector_T(this)
+    {
+    }
+    ~RWMutexCompactImpl() noexcept
+    {
+        assert((m_state.load() & (ReaderMask | WriteOwned | WriteWaiting)) == 0);
+    }
+
+    RWMutexCompactImpl(const RWMutexCompactImpl&) = delete;
+    RWMutexCompactImpl& operator=(const RWMutexCompactImpl&) = delete;
+    RWMutexCompactImpl(RWMutexCompactImpl&&) = delete;
+    RWMutexCompactImpl& operator=(RWMutexCompactImpl&&) = delete;
+
+    void read_lock()
+    {
+        check_read_lock();
+        acquire_read(nullptr);
+        detector().read_locked();
+    }
+    bool try_read_lock()
+    {
+        check_try_read_lock();
+        auto state = m_state.load(std::memory_order_relaxed);
+        while ((state & ReaderBlocked) == 0) {
+            if (m_state.compare_exchange_weak(state, state + ReaderOne,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                detector().read_locked();
+                return true;
+            }
+        }
+        return false;
+    }
+    template <typename Rep, typename Period>
+    bool try_read_lock_for(const std::chrono::duration<Rep, Period>& duration)
+    {
+        return try_read_lock_until(std::chrono::steady_clock::now() + duration);
+    }
+    template <typename Clock, typename Duration>
+    bool try_read_lock_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        check_try_read_lock();
+        auto steadyDeadline = to_steady(deadline);
+        if (!acquire_read(&steadyDeadline)) {
+            return false;
+        }
+        detector().read_locked();
+        return true;
+    }
+    // wake the claiming writer if it was the last reader
+    void read_unlock()
+    {
+        auto state = m_state.load(std::memory_order_relaxed);
+        do {
+            if ((state & ReaderMask) == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+        } while (!m_state.compare_exchange_weak(state, state - ReaderOne,
+            std::memory_order_release, std::memory_order_relaxed));
+        detector().read_unlocked();
+        if ((state & ReaderMask) == ReaderOne && (state & WriteWaiting) != 0) {
+            detail::futex_wake(word(), 1, WaitDrain);
+        }
+    }
+    // claim the lock so no new reader enters, then wait for the readers
+    void write_lock()
+    {
+        check_write_lock();
+        acquire_write(nullptr);
+        detector().write_locked();
+    }
+    bool try_write_lock()
+    {
+        check_try_write_lock();
+        auto state = m_state.load(std::memory_order_relaxed);
+        while ((state & (ReaderMask | WriterBlocked)) == 0) {
+            if (m_state.compare_exchange_weak(state, state | WriteOwned,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                detector().write_locked();
+                return true;
+            }
+        }
+        return false;
+    }
+    template <typename Rep, typename Period>
+    bool try_write_lock_for(const std::chrono::duration<Rep, Period>& duration)
+    {
+        return try_write_lock_until(std::chrono::steady_clock::now() + duration);
+    }
+    template <typename Clock, typename Duration>
+    bool try_write_lock_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        check_try_write_lock();
+        auto steadyDeadline = to_steady(deadline);
+        if (!acquire_write(&steadyDeadline)) {
+            return false;
+        }
+        detector().write_locked();
+        return true;
+    }
+    void write_unlock()
+    {
+        if ((m_state.load(std::memory_order_relaxed) & WriteOwned) == 0) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        detector().write_unlocked();
+        release(m_state.fetch_and(~(WriteOwned | Parked), std::memory_order_release));
+    }
+    // turn the write lock into a read lock without letting another writer in
+    void downgrade()
+    {
+        auto state = m_state.load(std::memory_order_relaxed);
+        do {
+            if ((state & WriteOwned) == 0) {
+                throw std::logic_error("Invalid call to downgrade");
+            }
+        } while (!m_state.compare_exchange_weak(state,
+            ((state & ~(WriteOwned | Parked)) + ReaderOne),
+            std::memory_order_release, std::memory_order_relaxed));
+        detector().write_unlocked();
+        detector().read_locked();
+        release(state);
+    }
+
+private:
+    using Deadline = detail::FutexDeadline;
+
+    static constexpr uint32_t ReaderOne = 1;
+    static constexpr uint32_t ReaderMask = (1u << 28) - 1;
+    static constexpr uint32_t WriteOwned = 1u << 28;
+    static constexpr uint32_t WriteWaiting = 1u << 29;
+    static constexpr uint32_t ReadersParked = 1u << 30;
+    static constexpr uint32_t WritersParked = 1u << 31;
+    static constexpr uint32_t Parked = ReadersParked | WritersParked;
+    static constexpr uint32_t ReaderBlocked = WriteOwned | WriteWaiting;
+    static constexpr uint32_t WriterBlocked = WriteOwned | WriteWaiting;
+    // the writer waiting for the readers to leave
+    static constexpr uint32_t WaitDrain = 0x4u;
+    static constexpr int SpinCount = 64;
+
+    DeadLockDetector_T& detector()
+    {
+        return *this;
+    }
+    const uint32_t* word() const
+    {
+        return detail::futex_word(m_state);
+    }
+    void check_read_lock()
+    {
+        if (detector().can_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_write_lock()
+    {
+        if (detector().can_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    // a try or timed lock can not dead lock, it does not check the order
+    void check_try_read_lock()
+    {
+        if (detector().can_try_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_try_write_lock()
+    {
+        if (detector().can_try_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    template <typename Clock, typename Duration>
+    static Deadline to_steady(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        if constexpr (std::is_same<Clock, std::chrono::steady_clock>::value) {
+            return std::chrono::ceil<Deadline::duration>(deadline);
+        } else {
+            return std::chrono::steady_clock::now()
+                + std::chrono::ceil<Deadline::duration>(deadline - Clock::now());
+        }
+    }
+    static bool expired(const Deadline* deadline)
+    {
+        return deadline != nullptr
+            && std::chrono::steady_clock::now() >= *deadline;
+    }
+
+    bool acquire_read(const Deadline* deadline)
+    {
+        auto state = m_state.load(std::memory_order_relaxed);
+        int spins = 0;
+        while (true) {
+            if ((state & ReaderBlocked) == 0) {
+                if (m_state.compare_exchange_weak(state, state + ReaderOne,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+                continue;
+            }
+            if (expired(deadline)) {
+                return false;
+            }
+            state = wait(state, ReadersParked, detail::FutexWaitReaders, deadline,
+                spins);
+        }
+    }
+    bool acquire_write(const Deadline* deadline)
+    {
+        // first claim the writer slot
+        auto state = m_state.load(std::memory_order_relaxed);
+        int spins = 0;
+        while (true) {
+            if ((state & WriterBlocked) == 0) {
+                if (m_state.compare_exchange_weak(state, state | WriteWaiting,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                    state |= WriteWaiting;
+                    break;
+                }
+                continue;
+            }
+            if (expired(deadline)) {
+                return false;
+            }
+            state = wait(state, WritersParked, detail::FutexWaitWriters, deadline,
+                spins);
+        }
+        // then wait for the readers to leave
+        while (true) {
+            if ((state & ReaderMask) == 0) {
+                if (m_state.compare_exchange_weak(state,
+                        (state & ~WriteWaiting) | WriteOwned,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+                continue;
+            }
+            if (expired(deadline)) {
+                // give the claim back, the readers it stopped may be parked
+                release(m_state.fetch_and(~(WriteWaiting | Parked),
+                    std::memory_order_relaxed));
+                return false;
+            }
+            if (spins < SpinCount) {
+                ++spins;
+                detail::cpu_relax();
+            } else {
+                detail::futex_wait(word(), state, WaitDrain, deadline);
+            }
+            state = m_state.load(std::memory_order_relaxed);
+        }
+    }
+    // spin, then set the parked flag and sleep until the word changes.
+    // returns the fresh state
+    uint32_t wait(uint32_t state, uint32_t parked, uint32_t mask,
+        const Deadline* deadline, int& spins)
+    {
+        if (spins < SpinCount) {
+            ++spins;
+            detail::cpu_relax();
+            return m_state.load(std::memory_order_relaxed);
+        }
+        if ((state & parked) == 0
+            && !m_state.compare_exchange_weak(state, state | parked,
+                std::memory_order_relaxed)) {
+            return state;
+        }
+        detail::futex_wait(word(), state | parked, mask, deadline);
+        return m_state.load(std::memory_order_relaxed);
+    }
+    // the parked flags were cleared from the given state, wake those threads
+    void release(uint32_t state)
+    {
+        uint32_t mask = 0;
+        if ((state & ReadersParked) != 0) {
+            mask |= detail::FutexWaitReaders;
+        }
+        if ((state & WritersParked) != 0) {
+            mask |= detail::FutexWaitWriters;
+        }
+        if (mask != 0) {
+            detail::futex_wake(word(), INT_MAX, mask);
+        }
+    }
+
+    std::atomic<uint32_t> m_state { 0 };
+};
+
+using RWMutexCompactUnchecked = RWMutexCompactImpl<RWMutexNullDeadLockDetector>;
+using RWMutexCompactChecked = RWMutexCompactImpl<RWMutexDeadLockDetector>;
+
+static_assert(sizeof(RWMutexCompactUnchecked) == sizeof(uint32_t),
+    "the unchecked compact mutex must be a single word");
+
+#ifndef NDEBUG
+using RWMutexCompact = RWMutexCompactChecked;
+#else
+using RWMutexCompact = RWMutexCompactUnchecked;
+#endif
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_COMPACT_H_
@@ -3,21 +3,44 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
+
 namespace hsqr {
 
+// called when a thread takes a mutex while holding another one, and the
+// opposite order was seen before (on any thread): held -> acquiring closes a
+// cycle in the lock order graph, which is a potential dead lock
+using RWMutexLockOrderHandler = void (*)(const void* held, const void* acquiring);
+
+// checks two things:
+//  - a thread does not mix read and write locks on the same mutex. tracked in
+//    a fixed size per thread stack of held locks, no allocation and no
+//    hashing on lock and unlock
+//  - all the threads take the mutexes in a consistent order. every time a
+//    thread blocks on a mutex while holding others, the edges held ->
+//    acquiring are added to a global lock order graph and a cycle is
+//    reported to the lock order handler. edges already seen by the thread
+//    are cached, so only new lock orders take the global graph mutex. a try
+//    or timed lock gives up instead of waiting forever, it is not ordered
+// locks must be released on the thread that took them. a thread holding more
+// than MaxHeld mutexes at the same time stops checking the extra ones.
 class RWMutexDeadLockDetector {
 public:
     RWMutexDeadLockDetector(void* id)
         : m_id(id)
     {
-        auto& s = store();
-        s.insert({ id, {} });
     }
     ~RWMutexDeadLockDetector()
     {
-        auto& s = store();
-        s.erase(m_id);
+        if (m_ordered.load(std::memory_order_relaxed)) {
+            graph().forget(m_id);
+        }
     }
     RWMutexDeadLockDetector(const RWMutexDeadLockDetector&) = delete;
     RWMutexDeadLockDetector& operator=(const RWMutexDeadLockDetector&) = delete;
@@ -26,48 +49,242 @@ public:
 
     void read_locked()
     {
-        auto& counter = store()[m_id];
-        counter.reads += 1;
+        if (auto entry = acquire_entry()) {
+            entry->reads += 1;
+        }
     }
     void read_unlocked()
     {
-        auto& counter = store()[m_id];
-        counter.reads -= 1;
+        if (auto entry = find(held())) {
+            entry->reads -= 1;
+            release_entry(entry);
+        }
     }
     void write_locked()
     {
-        auto& counter = store()[m_id];
-        counter.write = 1;
+        if (auto entry = acquire_entry()) {
+            entry->write = 1;
+        }
     }
     void write_unlocked()
     {
-        auto& counter = store()[m_id];
-        counter.write = 0;
+        if (auto entry = find(held())) {
+            entry->write = 0;
+            release_entry(entry);
+        }
     }
     bool can_read_lock()
     {
-        auto& counter = store()[m_id];
-        return counter.write == 0;
+        auto entry = check_order();
+        return entry == nullptr || entry->write == 0;
     }
     bool can_write_lock()
     {
-        auto& counter = store()[m_id];
-        return counter.write == 0 && counter.reads == 0;
+        return check_order() == nullptr;
+    }
+    // for the try and timed locks, only the read and write mix is checked
+    bool can_try_read_lock()
+    {
+        auto entry = find(held());
+        return entry == nullptr || entry->write == 0;
+    }
+    bool can_try_write_lock()
+    {
+        return find(held()) == nullptr;
+    }
+
+    // the default handler prints the two mutexes to stderr
+    static void set_lock_order_handler(RWMutexLockOrderHandler handler)
+    {
+        lock_order_handler().store(handler != nullptr ? handler : &print_lock_order);
     }
 
 private:
-    struct Counter {
-        uint16_t reads = 0;
-        uint16_t write = 0;
+    static constexpr std::size_t MaxHeld = 16;
+    static constexpr std::size_t EdgeCacheSize = 64;
+
+    struct Entry {
+        RWMutexDeadLockDetector* detector;
+        uint32_t reads;
+        uint32_t write;
+    };
+    struct Edge {
+        const void* from;
+        const void* to;
+        uint64_t generation;
+    };
+    struct Held {
+        Entry entries[MaxHeld];
+        std::size_t size = 0;
+        // recently added edges, direct mapped on the acquired mutex
+        Edge edges[EdgeCacheSize] = {};
+    };
+
+    class Graph {
+    public:
+        // add from -> to, returns false if to already reaches from
+        bool add(const void* from, const void* to)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& next = m_edges[from];
+            for (auto n : next) {
+                if (n == to) {
+                    return true;
+                }
+            }
+            next.push_back(to);
+            return !reaches(to, from);
+        }
+        // drop a destroyed mutex, its address may be reused by another one
+        void forget(const void* id)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_edges.erase(id);
+            for (auto& node : m_edges) {
+                auto& next = node.second;
+                for (std::size_t i = 0; i < next.size();) {
+                    if (next[i] == id) {
+                        next[i] = next.back();
+                        next.pop_back();
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+            m_generation.fetch_add(1, std::memory_order_relaxed);
+        }
+        // bumped by forget(), invalidates the per thread edge caches
+        uint64_t generation() const
+        {
+            return m_generation.load(std::memory_order_relaxed);
+        }
+
+    private:
+        bool reaches(const void* from, const void* to)
+        {
+            std::vector<const void*> stack { from };
+            std::vector<const void*> seen;
+            while (!stack.empty()) {
+                auto node = stack.back();
+                stack.pop_back();
+                if (node == to) {
+                    return true;
+                }
+                bool visited = false;
+                for (auto s : seen) {
+                    if (s == node) {
+                        visited = true;
+                        break;
+                    }
+                }
+                if (visited) {
+                    continue;
+                }
+                seen.push_back(node);
+                auto it = m_edges.find(node);
+                if (it != m_edges.end()) {
+                    stack.insert(stack.end(), it->second.begin(), it->second.end());
+                }
+            }
+            return false;
+        }
+
+        std::mutex m_mutex;
+        std::unordered_map<const void*, std::vector<const void*>> m_edges;
+        std::atomic<uint64_t> m_generation { 1 };
     };
-    std::unordered_map<void*, Counter>& store()
+
+    static Held& held()
     {
-        thread_local static std::unordered_map<void*, Counter> s;
-        return s;
+        thread_local static Held h;
+        return h;
     }
+    static Graph& graph()
+    {
+        static Graph g;
+        return g;
+    }
+    static std::atomic<RWMutexLockOrderHandler>& lock_order_handler()
+    {
+        static std::atomic<RWMutexLockOrderHandler> handler { &print_lock_order };
+        return handler;
+    }
+    static void print_lock_order(const void* held, const void* acquiring)
+    {
+        std::fprintf(stderr,
+            "hsqr: potential dead lock, mutex %p locked while holding %p, "
+            "the opposite order was seen before\n",
+            acquiring, held);
+    }
+
+    Entry* find(Held& h)
+    {
+        for (auto i = h.size; i > 0; --i) {
+            if (h.entries[i - 1].detector == this) {
+                return &h.entries[i - 1];
+            }
+        }
+        return nullptr;
+    }
+    Entry* acquire_entry()
+    {
+        auto& h = held();
+        if (auto entry = find(h)) {
+            return entry;
+        }
+        if (h.size == MaxHeld) {
+            return nullptr;
+        }
+        h.entries[h.size] = { this, 0, 0 };
+        return &h.entries[h.size++];
+    }
+    void release_entry(Entry* entry)
+    {
+        if (entry->reads != 0 || entry->write != 0) {
+            return;
+        }
+        auto& h = held();
+        for (auto e = entry + 1; e != h.entries + h.size; ++e) {
+            *(e - 1) = *e;
+        }
+        --h.size;
+    }
+    // record the order of the held mutexes before this one. returns the entry
+    // of this mutex if the thread already holds it
+    Entry* check_order()
+    {
+        auto& h = held();
+        if (auto entry = find(h)) {
+            return entry;
+        }
+        if (h.size == 0) {
+            return nullptr;
+        }
+        auto generation = graph().generation();
+        for (std::size_t i = 0; i < h.size; ++i) {
+            auto from = h.entries[i].detector;
+            auto& cached = h.edges[(reinterpret_cast<uintptr_t>(from)
+                                       ^ reinterpret_cast<uintptr_t>(this))
+                / alignof(void*) % EdgeCacheSize];
+            if (cached.from == from->m_id && cached.to == m_id
+                && cached.generation == generation) {
+                continue;
+            }
+            from->m_ordered.store(true, std::memory_order_relaxed);
+            m_ordered.store(true, std::memory_order_relaxed);
+            if (!graph().add(from->m_id, m_id)) {
+                lock_order_handler().load()(from->m_id, m_id);
+            }
+            cached = { from->m_id, m_id, generation };
+        }
+        return nullptr;
+    }
+
     void* m_id;
+    // set once the mutex is part of the lock order graph
+    std::atomic<bool> m_ordered { false };
 };
 
 } // namespace
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,195 @@
+#ifndef HSQR_RWMUTEX_DISTRIBUTED_H_
+#define HSQR_RWMUTEX_DISTRIBUTED_H_
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
+#include "hsqr/rwmutex.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWMutexDistributedDiag;
+};
+
+// big reader mutex. every reader thread increments its own cache line padded
+// slot, so readers never share a cache line with each other. a writer sets the
+// writer flag then scans all the slots until they are all zero, which makes
+// the write side O(SlotCount). use it for locks that are read very often and
+// written rarely.
+//
+// a thread always uses the same slot, so a read lock must be released by the
+// thread that took it.
+template <typename DeadLockDetector_T, std::size_t SlotCount = 64>
+class RWMutexDistributedImpl {
+    friend struct hsqr::test::RWMutexDistributedDiag;
+
+public:
+    using DeadLockDetector = DeadLockDetector_T;
+
+    RWMutexDistributedImpl() noexcept
+        : m_deadlockDetector(this)
+    {
+    }
+    ~RWMutexDistributedImpl() noexcept
+    {
+#ifndef NDEBUG
+        for (auto& slot : m_slots) {
+            assert(slot.readers.load() == 0);
+        }
+#endif
+        assert(m_writer.load() == WriterNone);
+    }
+
+    RWMutexDistributedImpl(const RWMutexDistributedImpl&) = delete;
+    RWMutexDistributedImpl& operator=(const RWMutexDistributedImpl&) = delete;
+    RWMutexDistributedImpl(RWMutexDistributedImpl&&) = delete;
+    RWMutexDistributedImpl& operator=(RWMutexDistributedImpl&&) = delete;
+
+    // increment the thread slot, back off and wait if a writer is active
+    void read_lock()
+    {
+        if (m_deadlockDetector.can_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+
+        auto& readers = m_slots[slot_index()].readers;
+        while (true) {
+            readers.fetch_add(1);
+            if (m_writer.load() == WriterNone) {
+                m_deadlockDetector.read_locked();
+                break;
+            }
+            // a writer is active, undo our increment and wait for it
+            if (readers.fetch_sub(1) == 1) {
+                notify_writer();
+            }
+            wait_writer(detail::FutexWaitReaders);
+        }
+    }
+    // decrement the thread slot, notify the writer if the slot drained
+    void read_unlock()
+    {
+        auto& readers = m_slots[slot_index()].readers;
+        auto count = readers.load(std::memory_order_relaxed);
+        do {
+            if (count == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+        } while (!readers.compare_exchange_weak(count, count - 1));
+        m_deadlockDetector.read_unlocked();
+        if (count == 1 && m_writer.load() != WriterNone) {
+            notify_writer();
+        }
+    }
+    // take the writer flag, then wait for all the slots to go to zero
+    void write_lock()
+    {
+        if (m_deadlockDetector.can_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+
+        uint32_t writer = WriterNone;
+        if (!m_writer.compare_exchange_strong(writer, WriterLocked)) {
+            // flag the word as parked so the owner wakes us up on unlock
+            if (writer != WriterParked) {
+                writer = m_writer.exchange(WriterParked);
+            }
+            while (writer != WriterNone) {
+                detail::futex_wait(detail::futex_word(m_writer), WriterParked,
+                    detail::FutexWaitWriters);
+                writer = m_writer.exchange(WriterParked);
+            }
+        }
+        m_deadlockDetector.write_locked();
+
+        while (true) {
+            auto drain = m_drain.load();
+            if (drained()) {
+                break;
+            }
+            detail::futex_wait(detail::futex_word(m_drain), drain);
+        }
+    }
+    // clear the writer flag and wake up the parked threads, if any
+    void write_unlock()
+    {
+        if (m_writer.load(std::memory_order_relaxed) == WriterNone) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        auto writer = m_writer.exchange(WriterNone, std::memory_order_release);
+        m_deadlockDetector.write_unlocked();
+        if (writer == WriterParked) {
+            detail::futex_wake(detail::futex_word(m_writer));
+        }
+    }
+
+private:
+    enum : uint32_t { WriterNone,
+        WriterLocked,
+        WriterParked };
+
+    struct alignas(detail::CacheLineSize) Slot {
+        std::atomic<uint32_t> readers { 0 };
+    };
+
+    // threads are assigned slots round robin
+    static std::size_t slot_index()
+    {
+        return detail::thread_index() % SlotCount;
+    }
+    bool drained() const
+    {
+        for (auto& slot : m_slots) {
+            if (slot.readers.load() != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void notify_writer()
+    {
+        m_drain.fetch_add(1);
+        detail::futex_wake(detail::futex_word(m_drain), 1);
+    }
+    void wait_writer(uint32_t wakeMask)
+    {
+        auto writer = m_writer.load();
+        while (writer != WriterNone) {
+            if (writer == WriterParked
+                || m_writer.compare_exchange_weak(writer, WriterParked)) {
+                detail::futex_wait(detail::futex_word(m_writer), WriterParked,
+                    wakeMask);
+                writer = m_writer.load();
+            }
+        }
+    }
+
+    Slot m_slots[SlotCount];
+    alignas(detail::CacheLineSize) std::atomic<uint32_t> m_writer { WriterNone };
+    std::atomic<uint32_t> m_drain { 0 };
+    DeadLockDetector_T m_deadlockDetector;
+};
+
+using RWMutexDistributedUnchecked = RWMutexDistributedImpl<RWMutexNullDeadLockDetector>;
+using RWMutexDistributedChecked = RWMutexDistributedImpl<RWMutexDeadLockDetector>;
+
+#ifndef NDEBUG
+using RWMutexDistributed = RWMutexDistributedChecked;
+#else
+using RWMutexDistributed = RWMutexDistributedUnchecked;
+#endif
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_DISTRIBUTED_H_
@@ -0,0 +1,124 @@
+#ifndef HSQR_RWMUTEX_FAIRNESS_H_
+#define HSQR_RWMUTEX_FAIRNESS_H_
+
+#pragma once
+
+#include <cstdint>
+
+namespace hsqr {
+
+namespace detail {
+
+    // 64 bit state word of RWMutexImpl:
+    //  bits  0..31 number of readers holding the lock
+    //  bit      32 a writer owns the lock
+    //  bit      33 a writer claimed the lock and waits for the readers to leave
+    //  bit      34 one of the readers holds the upgradable lock
+    //  bit      35 reader phase, the readers woken by the last write unlock
+    //              have not all entered yet (phase fair only), or writers
+    //              are queued for a handoff (priority handoff only)
+    //  bits 36..49 number of readers parked on the high word
+    //  bits 50..63 number of writers parked on the high word
+    struct RWMutexState {
+        static constexpr uint64_t ReaderOne = 1;
+        static constexpr uint64_t ReaderMask = 0xffffffffull;
+        static constexpr uint64_t WriteOwned = 1ull << 32;
+        static constexpr uint64_t WriteWaiting = 1ull << 33;
+        static constexpr uint64_t Upgradable = 1ull << 34;
+        static constexpr uint64_t ReaderPhase = 1ull << 35;
+        static constexpr uint64_t HandoffQueued = 1ull << 35;
+        static constexpr uint64_t ParkedReaderOne = 1ull << 36;
+        static constexpr uint64_t ParkedReaderMask = 0x3fffull << 36;
+        static constexpr uint64_t ParkedWriterOne = 1ull << 50;
+        static constexpr uint64_t ParkedWriterMask = 0x3fffull << 50;
+    };
+
+} // namespace detail
+
+// fairness policies of RWMutexImpl. a policy tells if an arriving reader has
+// to wait, and which parked threads a write unlock wakes up:
+//  - reader_blocked(state): an arriving reader waits while it returns true
+//  - WritersFirst: a write unlock wakes one parked writer and leaves the
+//    parked readers asleep, the readers are only woken when no writer waits
+//  - ReaderPhases: a write unlock with parked readers opens a reader phase.
+//    new writers can not claim the lock until all of those readers entered
+//  - Handoff: blocked writers queue by priority and the thread releasing
+//    the writer side passes it to the most urgent one
+// without a handoff writers are not ordered among themselves, the first to
+// claim the lock after a release gets it.
+
+// readers only wait for a writer that owns the lock, a writer waiting for
+// the readers to leave does not stop new readers. readers never wait for
+// more than one write critical section; a writer can starve as long as the
+// read critical sections overlap.
+struct RWMutexReaderPreferring {
+    static constexpr bool reader_blocked(uint64_t state)
+    {
+        return (state & detail::RWMutexState::WriteOwned) != 0;
+    }
+    static constexpr bool WritersFirst = false;
+    static constexpr bool ReaderPhases = false;
+    static constexpr bool Handoff = false;
+};
+
+// a writer that claimed the lock or is parked waiting for it stops new
+// readers, and a write unlock hands over to the next writer before the
+// readers. a writer waits at most for the readers already inside; readers
+// can starve under a continuous stream of writers.
+struct RWMutexWriterPreferring {
+    static constexpr bool reader_blocked(uint64_t state)
+    {
+        return (state
+                   & (detail::RWMutexState::WriteOwned
+                       | detail::RWMutexState::WriteWaiting
+                       | detail::RWMutexState::ParkedWriterMask))
+            != 0;
+    }
+    static constexpr bool WritersFirst = true;
+    static constexpr bool ReaderPhases = false;
+    static constexpr bool Handoff = false;
+};
+
+// readers and writers alternate. a claimed writer stops new readers, and
+// a write unlock admits all the readers that queued behind it as one batch
+// before the next writer. a reader waits for at most one writer; between two
+// writers there is at most one reader phase.
+struct RWMutexPhaseFair {
+    static constexpr bool reader_blocked(uint64_t state)
+    {
+        return (state
+                   & (detail::RWMutexState::WriteOwned
+                       | detail::RWMutexState::WriteWaiting))
+            != 0;
+    }
+    static constexpr bool WritersFirst = false;
+    static constexpr bool ReaderPhases = true;
+    static constexpr bool Handoff = false;
+};
+
+// writer preferring, and a writer that has to wait queues with the priority
+// of its thread (see RWMutexPriority in rwmutex-handoff.h) instead of
+// racing for the lock. whoever releases the writer side, a writer, the
+// upgradable holder or a writer giving up, hands it directly to the queued
+// writer with the highest priority, first come first served among equal
+// priorities. while writers are queued new readers and writers wait, so an
+// urgent writer waits for at most the current holder and the readers
+// already inside.
+struct RWMutexPriorityHandoff {
+    static constexpr bool reader_blocked(uint64_t state)
+    {
+        return (state
+                   & (detail::RWMutexState::WriteOwned
+                       | detail::RWMutexState::WriteWaiting
+                       | detail::RWMutexState::HandoffQueued
+                       | detail::RWMutexState::ParkedWriterMask))
+            != 0;
+    }
+    static constexpr bool WritersFirst = true;
+    static constexpr bool ReaderPhases = false;
+    static constexpr bool Handoff = true;
+};
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_FAIRNESS_H_
@@ -0,0 +1,130 @@
+#ifndef HSQR_RWMUTEX_HANDOFF_H_
+#define HSQR_RWMUTEX_HANDOFF_H_
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+namespace detail {
+
+    inline int& thread_lock_priority()
+    {
+        thread_local static int priority = 0;
+        return priority;
+    }
+
+} // namespace detail
+
+// sets the priority the calling thread waits with for a write lock of a
+// mutex using the RWMutexPriorityHandoff policy, until the end of the scope.
+// the most urgent waiter has the highest priority, the default is 0
+class RWMutexPriority {
+public:
+    explicit RWMutexPriority(int priority)
+        : m_previous(std::exchange(detail::thread_lock_priority(), priority))
+    {
+    }
+    ~RWMutexPriority()
+    {
+        detail::thread_lock_priority() = m_previous;
+    }
+    RWMutexPriority(const RWMutexPriority&) = delete;
+    RWMutexPriority& operator=(const RWMutexPriority&) = delete;
+
+    // priority of the calling thread
+    static int current()
+    {
+        return detail::thread_lock_priority();
+    }
+
+private:
+    int m_previous;
+};
+
+namespace detail {
+
+    // writers queued for a handoff, per mutex. the queues live in a table of
+    // buckets hashed by mutex address, like a parking lot, so the mutex
+    // itself only carries a flag telling that it has queued writers
+    class HandoffQueue {
+    public:
+        struct Waiter {
+            const void* mutex;
+            int priority;
+            // set to 1 once the writer slot was handed over
+            std::atomic<uint32_t> granted { 0 };
+            Waiter* next = nullptr;
+        };
+
+        static HandoffQueue& of(const void* mutex)
+        {
+            static HandoffQueue table[BucketCount];
+            return table[std::hash<const void*>()(mutex) % BucketCount];
+        }
+
+        std::mutex& mutex()
+        {
+            return m_mutex;
+        }
+        // after the waiters of higher or equal priority. needs the lock
+        void insert(Waiter* waiter)
+        {
+            auto link = &m_head;
+            while (*link && (*link)->priority >= waiter->priority) {
+                link = &(*link)->next;
+            }
+            waiter->next = *link;
+            *link = waiter;
+        }
+        // the most urgent waiter of the mutex, or nullptr. needs the lock
+        Waiter* pop(const void* mutex)
+        {
+            for (auto link = &m_head; *link; link = &(*link)->next) {
+                if ((*link)->mutex == mutex) {
+                    auto waiter = *link;
+                    *link = waiter->next;
+                    return waiter;
+                }
+            }
+            return nullptr;
+        }
+        void remove(Waiter* waiter)
+        {
+            for (auto link = &m_head; *link; link = &(*link)->next) {
+                if (*link == waiter) {
+                    *link = waiter->next;
+                    return;
+                }
+            }
+        }
+        bool has(const void* mutex) const
+        {
+            for (auto waiter = m_head; waiter; waiter = waiter->next) {
+                if (waiter->mutex == mutex) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        static constexpr std::size_t BucketCount = 64;
+
+        alignas(CacheLineSize) std::mutex m_mutex;
+        Waiter* m_head = nullptr;
+    };
+
+} // namespace detail
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_HANDOFF_H_
@@ -0,0 +1,347 @@
+#ifndef HSQR_RWMUTEX_PROCESS_SHARED_H_
+#define HSQR_RWMUTEX_PROCESS_SHARED_H_
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <cstdio>
+#endif
+
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWMutexProcessSharedDiag;
+};
+
+namespace detail {
+
+    // pid of the calling process. getpid() is a system call, the value is
+    // cached and reset in the child after a fork
+    inline uint32_t current_pid()
+    {
+        static std::atomic<uint32_t> cached { 0 };
+        auto pid = cached.load(std::memory_order_relaxed);
+        if (pid == 0) {
+            static bool registered = (pthread_atfork(nullptr, nullptr,
+                                          []() { cached.store(0); }),
+                true);
+            (void)registered;
+            pid = static_cast<uint32_t>(getpid());
+            cached.store(pid, std::memory_order_relaxed);
+        }
+        return pid;
+    }
+
+    // false once the process exited, even if its parent did not reap it yet
+    inline bool process_alive(uint32_t pid)
+    {
+        if (kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH) {
+            return false;
+        }
+#ifdef __linux__
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+        if (auto file = std::fopen(path, "r")) {
+            // pid (comm) state ..., comm may contain spaces and parentheses
+            char buffer[512];
+            auto size = std::fread(buffer, 1, sizeof(buffer) - 1, file);
+            std::fclose(file);
+            buffer[size] = '\0';
+            for (auto i = size; i > 0; --i) {
+                if (buffer[i - 1] == ')') {
+                    auto state = i + 1 < size ? buffer[i + 1] : '\0';
+                    return state != 'Z' && state != 'X';
+                }
+            }
+        }
+#endif
+        return true;
+    }
+
+} // namespace detail
+
+// reader writer lock shared by several processes, for data in memory mapped
+// with MAP_SHARED. the mutex only holds atomic integers: it can be placed
+// with new in the mapping, and a zero filled mapping (a fresh file or
+// anonymous memory) is already an unlocked mutex. the processes may map it at
+// different addresses and must see the same pids, i.e. share a pid namespace.
+//
+// it is built like RWMutexCohortImpl with a process in place of a node:
+//  - a reader counts itself in the slot of its process. a slot is claimed by
+//    the first reader of the process and keeps its pid
+//  - a writer stores its pid in the writer word, which stops new readers,
+//    then waits for the reader counts of all the slots to drop to zero
+// every wait goes through a process shared futex and times out every
+// LivenessCheck to look for dead processes:
+//  - if the process holding the write lock died, the waiter releases the
+//    lock in its place and owner_died() reports it until mark_consistent()
+//    is called: the protected data may be half written
+//  - the reads of a dead process are dropped from its slot
+// a dead process is detected by its pid, so one reused by a new process
+// before the check hides the death.
+//
+// locks belong to the process, not to the thread: any thread of the owner
+// process may release them. a process must not ask for the write lock while
+// it holds a read lock, there is no dead lock detection.
+template <std::size_t MaxProcesses = 32>
+class RWMutexProcessSharedImpl {
+    friend struct hsqr::test::RWMutexProcessSharedDiag;
+    static_assert(MaxProcesses > 0, "need at least one process slot");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+        "shared atomics must be lock free");
+
+public:
+    static constexpr std::chrono::milliseconds LivenessCheck { 50 };
+
+    RWMutexProcessSharedImpl() noexcept = default;
+
+    RWMutexProcessSharedImpl(const RWMutexProcessSharedImpl&) = delete;
+    RWMutexProcessSharedImpl& operator=(const RWMutexProcessSharedImpl&) = delete;
+    RWMutexProcessSharedImpl(RWMutexProcessSharedImpl&&) = delete;
+    RWMutexProcessSharedImpl& operator=(RWMutexProcessSharedImpl&&) = delete;
+
+    // count the reader in the slot of the process, back off and wait while a
+    // writer holds the lock
+    void read_lock()
+    {
+        auto& slot = own_slot();
+        while (true) {
+            slot.word.fetch_add(1);
+            auto writer = m_writer.load();
+            if (writer == 0) {
+                return;
+            }
+            leave(slot);
+            wait_writer(writer);
+        }
+    }
+    bool try_read_lock()
+    {
+        auto& slot = own_slot();
+        slot.word.fetch_add(1);
+        if (m_writer.load() == 0) {
+            return true;
+        }
+        leave(slot);
+        return false;
+    }
+    void read_unlock()
+    {
+        auto& slot = own_slot();
+        auto word = slot.word.load(std::memory_order_relaxed);
+        if ((word & CountMask) == 0) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        leave(slot);
+    }
+    // store the pid in the writer word, then wait for the readers of all
+    // the processes to leave
+    void write_lock()
+    {
+        auto self = detail::current_pid();
+        uint32_t writer = 0;
+        while (!m_writer.compare_exchange_weak(writer, self)) {
+            if (writer != 0) {
+                wait_writer(writer);
+                writer = 0;
+            }
+        }
+        for (auto& slot : m_slots) {
+            drain(slot);
+        }
+    }
+    bool try_write_lock()
+    {
+        uint32_t writer = 0;
+        if (!m_writer.compare_exchange_strong(writer, detail::current_pid())) {
+            return false;
+        }
+        for (auto& slot : m_slots) {
+            if ((slot.word.load() & CountMask) != 0) {
+                release();
+                return false;
+            }
+        }
+        return true;
+    }
+    void write_unlock()
+    {
+        if ((m_writer.load(std::memory_order_relaxed) & PidMask)
+            != detail::current_pid()) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        release();
+    }
+
+    // true if a process died while it held the write lock, until
+    // mark_consistent() is called
+    bool owner_died() const
+    {
+        return m_ownerDied.load() != 0;
+    }
+    // the data was checked or repaired after the death of a writer
+    void mark_consistent()
+    {
+        m_ownerDied.store(0);
+    }
+
+private:
+    // pid of the writer, with Parked once someone sleeps on the word
+    static constexpr uint32_t Parked = 0x80000000u;
+    static constexpr uint32_t PidMask = ~Parked;
+    // slot word: pid << 32 | read count
+    static constexpr uint64_t CountMask = 0xffffffffu;
+
+    struct alignas(detail::CacheLineSize) Slot {
+        std::atomic<uint64_t> word { 0 };
+    };
+
+    static uint32_t slot_pid(uint64_t word)
+    {
+        return static_cast<uint32_t>(word >> 32);
+    }
+    static detail::FutexDeadline check_deadline()
+    {
+        return std::chrono::steady_clock::now() + LivenessCheck;
+    }
+
+    // the slot of the calling process, claimed on first use. slots are never
+    // given back to zero, so the probe sequence of a pid never gets shorter
+    // and its slot is always found at the same place
+    Slot& own_slot()
+    {
+        auto self = detail::current_pid();
+        auto start = self % MaxProcesses;
+        for (std::size_t i = 0; i < MaxProcesses; ++i) {
+            auto& slot = m_slots[(start + i) % MaxProcesses];
+            auto word = slot.word.load(std::memory_order_relaxed);
+            if (slot_pid(word) == self) {
+                return slot;
+            }
+            if (word == 0) {
+                return claim_slot(self);
+            }
+        }
+        return claim_slot(self);
+    }
+    // slow path, one thread of the process at a time so that the process
+    // never ends up with two slots
+    Slot& claim_slot(uint32_t self)
+    {
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto start = self % MaxProcesses;
+        for (std::size_t i = 0; i < MaxProcesses; ++i) {
+            auto& slot = m_slots[(start + i) % MaxProcesses];
+            auto word = slot.word.load();
+            if (word == 0
+                && slot.word.compare_exchange_strong(word, uint64_t(self) << 32)) {
+                return slot;
+            }
+            if (slot_pid(word) == self) {
+                return slot;
+            }
+        }
+        // the table is full, take over the slot of a dead process
+        for (std::size_t i = 0; i < MaxProcesses; ++i) {
+            auto& slot = m_slots[(start + i) % MaxProcesses];
+            auto word = slot.word.load();
+            if (!detail::process_alive(slot_pid(word))
+                && slot.word.compare_exchange_strong(word, uint64_t(self) << 32)) {
+                return slot;
+            }
+        }
+        throw std::runtime_error("Too many processes share the mutex");
+    }
+    // drop a read count, notify the writer if it was the last one
+    void leave(Slot& slot)
+    {
+        if ((slot.word.fetch_sub(1) & CountMask) == 1 && m_writer.load() != 0) {
+            m_drain.fetch_add(1);
+            detail::futex_wake(detail::futex_word(m_drain), INT_MAX,
+                detail::FutexWaitAny, detail::FutexScope::Shared);
+        }
+    }
+    // clear the writer word and wake everyone who waits on it
+    void release()
+    {
+        if ((m_writer.exchange(0) & Parked) != 0) {
+            detail::futex_wake(detail::futex_word(m_writer), INT_MAX,
+                detail::FutexWaitAny, detail::FutexScope::Shared);
+        }
+    }
+    // sleep until the writer word changes from the given value. if it did not
+    // change for LivenessCheck and its process is gone, release the lock in
+    // place of the dead writer
+    void wait_writer(uint32_t writer)
+    {
+        if ((writer & Parked) == 0) {
+            if (!m_writer.compare_exchange_strong(writer, writer | Parked)) {
+                return;
+            }
+            writer |= Parked;
+        }
+        auto deadline = check_deadline();
+        detail::futex_wait(detail::futex_word(m_writer), writer,
+            detail::FutexWaitAny, &deadline, detail::FutexScope::Shared);
+        if (m_writer.load() == writer && std::chrono::steady_clock::now() >= deadline
+            && !detail::process_alive(writer & PidMask)
+            && m_writer.compare_exchange_strong(writer, 0)) {
+            m_ownerDied.store(1);
+            detail::futex_wake(detail::futex_word(m_writer), INT_MAX,
+                detail::FutexWaitAny, detail::FutexScope::Shared);
+        }
+    }
+    // wait for the readers of a slot to leave, drop the reads of a process
+    // that died
+    void drain(Slot& slot)
+    {
+        while (true) {
+            auto drain = m_drain.load();
+            auto word = slot.word.load();
+            if ((word & CountMask) == 0) {
+                return;
+            }
+            auto deadline = check_deadline();
+            detail::futex_wait(detail::futex_word(m_drain), drain,
+                detail::FutexWaitAny, &deadline, detail::FutexScope::Shared);
+            if (slot.word.load() == word && std::chrono::steady_clock::now() >= deadline
+                && !detail::process_alive(slot_pid(word))) {
+                slot.word.compare_exchange_strong(word, word & ~CountMask);
+            }
+        }
+    }
+
+    Slot m_slots[MaxProcesses];
+    alignas(detail::CacheLineSize) std::atomic<uint32_t> m_writer { 0 };
+    std::atomic<uint32_t> m_drain { 0 };
+    std::atomic<uint32_t> m_ownerDied { 0 };
+};
+
+using RWMutexProcessShared = RWMutexProcessSharedImpl<>;
+
+static_assert(std::is_standard_layout<RWMutexProcessShared>::value
+        && std::is_trivially_destructible<RWMutexProcessShared>::value,
+    "the process shared mutex must be usable in raw shared memory");
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_PROCESS_SHARED_H_
@@ -0,0 +1,323 @@
+#ifndef HSQR_RWMUTEX_QUEUE_H_
+#define HSQR_RWMUTEX_QUEUE_H_
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+
+#include "hsqr/futex.h"
+#include "hsqr/platform.h"
+#include "hsqr/rwmutex.h"
+
+namespace hsqr {
+
+namespace test {
+    struct RWMutexQueueDiag;
+};
+
+// reader writer lock where the waiters line up in an MCS queue, for locks
+// contended by many cores. the lock itself is held in one word:
+//  bits  0..1  a writer owns the lock, the queue head sleeps on the word
+//  bits  2..31 number of readers holding the lock
+// a thread that can not take the lock at once appends a node, living on its
+// stack, to the queue and spins on its own cache line until its predecessor
+// hands it the head of the queue. only the head waits on the lock word:
+//  - a reader at the head counts itself in, waits for the writer to leave,
+//    then passes the head on at once. a run of readers in the queue is so
+//    admitted together, one after the other
+//  - a writer at the head waits for the lock word to clear, takes it, then
+//    passes the head on
+// the lock goes to the waiters in FIFO order, a new thread only bypasses
+// the queue while it is empty. spinning threads park on a futex after
+// SpinCount rounds, a handoff wakes exactly the next thread.
+//
+// the queue nodes are only needed while waiting: a lock may be released by
+// another thread than the one that took it. there are no timed locks, a
+// node can not leave the middle of the queue, and no upgradable lock.
+template <typename DeadLockDetector_T>
+class RWMutexQueueImpl {
+    friend struct hsqr::test::RWMutexQueueDiag;
+
+public:
+    using DeadLockDetector = DeadLockDetector_T;
+
+    RWMutexQueueImpl() noexcept
+        : m_deadlockDetector(this)
+    {
+    }
+    ~RWMutexQueueImpl() noexcept
+    {
+        assert((m_state.load() & ~HeadParked) == 0);
+        assert(m_tail.load() == nullptr);
+    }
+
+    RWMutexQueueImpl(const RWMutexQueueImpl&) = delete;
+    RWMutexQueueImpl& operator=(const RWMutexQueueImpl&) = delete;
+    RWMutexQueueImpl(RWMutexQueueImpl&&) = delete;
+    RWMutexQueueImpl& operator=(RWMutexQueueImpl&&) = delete;
+
+    void read_lock()
+    {
+        check_read_lock();
+        if (!fast_read_lock()) {
+            Node node;
+            enqueue(node);
+            // count in, the reader behind us may enter as soon as we pass
+            // the head on
+            auto state = m_state.fetch_add(ReaderOne, std::memory_order_acquire);
+            while ((state & WriteOwned) != 0) {
+                state = wait_state(state);
+            }
+            dequeue(node);
+        }
+        m_deadlockDetector.read_locked();
+    }
+    bool try_read_lock()
+    {
+        check_try_read_lock();
+        if (!fast_read_lock()) {
+            return false;
+        }
+        m_deadlockDetector.read_locked();
+        return true;
+    }
+    // wake the queue head if it waits for the readers to leave
+    void read_unlock()
+    {
+        auto state = m_state.load(std::memory_order_relaxed);
+        do {
+            if ((state & ReaderMask) == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+        } while (!m_state.compare_exchange_weak(state, state - ReaderOne,
+            std::memory_order_release, std::memory_order_relaxed));
+        m_deadlockDetector.read_unlocked();
+        if ((state & ReaderMask) == ReaderOne && (state & HeadParked) != 0) {
+            wake_head();
+        }
+    }
+    void write_lock()
+    {
+        check_write_lock();
+        if (!fast_write_lock()) {
+            Node node;
+            enqueue(node);
+            auto state = m_state.load(std::memory_order_relaxed);
+            while (true) {
+                if ((state & ~HeadParked) == 0) {
+                    if (m_state.compare_exchange_weak(state, WriteOwned,
+                            std::memory_order_acquire, std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+                state = wait_state(state);
+            }
+            dequeue(node);
+        }
+        m_deadlockDetector.write_locked();
+    }
+    bool try_write_lock()
+    {
+        check_try_write_lock();
+        if (!fast_write_lock()) {
+            return false;
+        }
+        m_deadlockDetector.write_locked();
+        return true;
+    }
+    void write_unlock()
+    {
+        if ((m_state.load(std::memory_order_relaxed) & WriteOwned) == 0) {
+            throw std::logic_error("Invalid call to unlock");
+        }
+        m_deadlockDetector.write_unlocked();
+        if ((m_state.fetch_and(~(WriteOwned | HeadParked), std::memory_order_release)
+                & HeadParked)
+            != 0) {
+            detail::futex_wake(word(), 1);
+        }
+    }
+    // turn the write lock into a read lock, the readers at the head of the
+    // queue get in with it
+    void downgrade()
+    {
+        auto state = m_state.load(std::memory_order_relaxed);
+        do {
+            if ((state & WriteOwned) == 0) {
+                throw std::logic_error("Invalid call to downgrade");
+            }
+        } while (!m_state.compare_exchange_weak(state,
+            (state & ~(WriteOwned | HeadParked)) + ReaderOne,
+            std::memory_order_release, std::memory_order_relaxed));
+        m_deadlockDetector.write_unlocked();
+        m_deadlockDetector.read_locked();
+        if ((state & HeadParked) != 0) {
+            detail::futex_wake(word(), 1);
+        }
+    }
+
+private:
+    static constexpr uint32_t WriteOwned = 1;
+    static constexpr uint32_t HeadParked = 2;
+    static constexpr uint32_t ReaderOne = 4;
+    static constexpr uint32_t ReaderMask = ~(WriteOwned | HeadParked);
+    static constexpr int SpinCount = 128;
+
+    // node.state
+    static constexpr uint32_t Waiting = 0;
+    static constexpr uint32_t Parked = 1;
+    static constexpr uint32_t Head = 2;
+
+    struct alignas(detail::CacheLineSize) Node {
+        std::atomic<Node*> next { nullptr };
+        std::atomic<uint32_t> state { Waiting };
+    };
+
+    const uint32_t* word() const
+    {
+        return detail::futex_word(m_state);
+    }
+    void check_read_lock()
+    {
+        if (m_deadlockDetector.can_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_write_lock()
+    {
+        if (m_deadlockDetector.can_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    // a try or timed lock can not dead lock, it does not check the order
+    void check_try_read_lock()
+    {
+        if (m_deadlockDetector.can_try_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_try_write_lock()
+    {
+        if (m_deadlockDetector.can_try_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+
+    // the lock is free for us only while nobody is queued
+    bool fast_read_lock()
+    {
+        if (m_tail.load(std::memory_order_relaxed) != nullptr) {
+            return false;
+        }
+        auto state = m_state.load(std::memory_order_relaxed);
+        while ((state & WriteOwned) == 0) {
+            if (m_state.compare_exchange_weak(state, state + ReaderOne,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool fast_write_lock()
+    {
+        uint32_t state = 0;
+        return m_tail.load(std::memory_order_relaxed) == nullptr
+            && m_state.compare_exchange_strong(state, WriteOwned,
+                std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    // append the node and wait, on the node, until it is the head
+    void enqueue(Node& node)
+    {
+        auto prev = m_tail.exchange(&node, std::memory_order_acq_rel);
+        if (prev == nullptr) {
+            return;
+        }
+        prev->next.store(&node, std::memory_order_release);
+        for (int spins = 0; spins < SpinCount; ++spins) {
+            if (node.state.load(std::memory_order_acquire) == Head) {
+                return;
+            }
+            detail::cpu_relax();
+        }
+        auto state = Waiting;
+        if (node.state.compare_exchange_strong(state, Parked,
+                std::memory_order_acquire)) {
+            do {
+                detail::futex_wait(detail::futex_word(node.state), Parked);
+            } while (node.state.load(std::memory_order_acquire) != Head);
+        }
+    }
+    // pass the head to the next node, or empty the queue
+    void dequeue(Node& node)
+    {
+        auto next = node.next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            auto self = &node;
+            if (m_tail.compare_exchange_strong(self, nullptr,
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+            // a thread swapped the tail but did not link itself yet
+            while ((next = node.next.load(std::memory_order_acquire)) == nullptr) {
+                detail::cpu_relax();
+            }
+        }
+        // the next thread may return and free its node right after the
+        // exchange, only its address is used for the wake
+        if (next->state.exchange(Head, std::memory_order_release) == Parked) {
+            detail::futex_wake(detail::futex_word(next->state), 1);
+        }
+    }
+    // the head waits for the lock word to change from the given state,
+    // spinning first, then parked. returns the fresh state
+    uint32_t wait_state(uint32_t state)
+    {
+        for (int spins = 0; spins < SpinCount; ++spins) {
+            detail::cpu_relax();
+            auto fresh = m_state.load(std::memory_order_acquire);
+            if (fresh != state) {
+                return fresh;
+            }
+        }
+        if ((state & HeadParked) == 0
+            && !m_state.compare_exchange_strong(state, state | HeadParked,
+                std::memory_order_relaxed)) {
+            return state;
+        }
+        detail::futex_wait(word(), state | HeadParked);
+        return m_state.load(std::memory_order_acquire);
+    }
+    void wake_head()
+    {
+        if ((m_state.fetch_and(~HeadParked, std::memory_order_relaxed) & HeadParked)
+            != 0) {
+            detail::futex_wake(word(), 1);
+        }
+    }
+
+    DeadLockDetector_T m_deadlockDetector;
+    alignas(detail::CacheLineSize) std::atomic<uint32_t> m_state { 0 };
+    alignas(detail::CacheLineSize) std::atomic<Node*> m_tail { nullptr };
+};
+
+using RWMutexQueueUnchecked = RWMutexQueueImpl<RWMutexNullDeadLockDetector>;
+using RWMutexQueueChecked = RWMutexQueueImpl<RWMutexDeadLockDetector>;
+
+#ifndef NDEBUG
+using RWMutexQueue = RWMutexQueueChecked;
+#else
+using RWMutexQueue = RWMutexQueueUnchecked;
+#endif
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_QUEUE_H_
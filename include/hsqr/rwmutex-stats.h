@@ -0,0 +1,231 @@
+#ifndef HSQR_RWMUTEX_STATS_H_
+#define HSQR_RWMUTEX_STATS_H_
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+// statistics policies of RWMutexImpl, constructed with the address of the
+// mutex. the mutex calls:
+//  - start(write) before it tries to take the lock, the returned timer is
+//    passed back to read_locked/write_locked or abandoned
+//  - read_locked(timer, contended, readers) once a read lock is taken.
+//    contended is true if the thread had to wait, readers is the number of
+//    readers holding the lock including this one
+//  - write_locked(timer, contended) once a write lock is taken
+//  - abandoned(timer) when a try or timed lock gives up
+//  - read_unlocked() and write_unlocked() after a release
+
+// records nothing and compiles to nothing
+class RWMutexNullStats {
+public:
+    struct Timer {
+    };
+    RWMutexNullStats() = default;
+    explicit RWMutexNullStats(const void*) { }
+
+    Timer start(bool) { return {}; }
+    void abandoned(const Timer&) { }
+    void read_locked(const Timer&, bool, uint64_t) { }
+    void read_unlocked() { }
+    void write_locked(const Timer&, bool) { }
+    void write_unlocked() { }
+};
+
+// totals of a RWMutexStatsImpl. the histograms count durations in power of
+// two nanosecond buckets: bucket 0 is 0ns, bucket i is [2^(i-1), 2^i) ns and
+// the last bucket holds everything longer
+struct RWMutexStatsSnapshot {
+    static constexpr std::size_t Buckets = 32;
+    using Histogram = std::array<uint64_t, Buckets>;
+
+    uint64_t readAcquisitions = 0;
+    uint64_t readContended = 0;
+    uint64_t writeAcquisitions = 0;
+    uint64_t writeContended = 0;
+    uint64_t maxReaders = 0;
+    Histogram readWait {};
+    Histogram readHold {};
+    Histogram writeWait {};
+    Histogram writeHold {};
+};
+
+// counts acquisitions and records wait and hold times. every thread updates
+// its own cache line padded shard, threads are spread over ShardCount shards,
+// so recording does not add traffic on a shared cache line; stats() sums the
+// shards. hold times are tracked per thread for up to MaxHeld locks held at
+// the same time, deeper nesting is counted but its hold time is not
+// recorded. locks must be released on the thread that took them.
+template <std::size_t ShardCount = 16>
+class RWMutexStatsImpl {
+public:
+    using Clock = std::chrono::steady_clock;
+    struct Timer {
+        Clock::time_point start;
+    };
+
+    RWMutexStatsImpl() = default;
+    explicit RWMutexStatsImpl(const void*) { }
+    RWMutexStatsImpl(const RWMutexStatsImpl&) = delete;
+    RWMutexStatsImpl& operator=(const RWMutexStatsImpl&) = delete;
+    RWMutexStatsImpl(RWMutexStatsImpl&&) = delete;
+    RWMutexStatsImpl& operator=(RWMutexStatsImpl&&) = delete;
+
+    Timer start(bool) { return { Clock::now() }; }
+    void abandoned(const Timer&) { }
+    void read_locked(const Timer& timer, bool contended, uint64_t readers)
+    {
+        auto now = Clock::now();
+        auto& shard = this->shard();
+        add(shard.readAcquisitions);
+        if (contended) {
+            add(shard.readContended);
+        }
+        if (readers > shard.maxReaders.load(std::memory_order_relaxed)) {
+            shard.maxReaders.store(readers, std::memory_order_relaxed);
+        }
+        add(shard.readWait[bucket(now - timer.start)]);
+        push(now);
+    }
+    void read_unlocked()
+    {
+        Clock::time_point start;
+        if (pop(start)) {
+            add(shard().readHold[bucket(Clock::now() - start)]);
+        }
+    }
+    void write_locked(const Timer& timer, bool contended)
+    {
+        auto now = Clock::now();
+        auto& shard = this->shard();
+        add(shard.writeAcquisitions);
+        if (contended) {
+            add(shard.writeContended);
+        }
+        add(shard.writeWait[bucket(now - timer.start)]);
+        push(now);
+    }
+    void write_unlocked()
+    {
+        Clock::time_point start;
+        if (pop(start)) {
+            add(shard().writeHold[bucket(Clock::now() - start)]);
+        }
+    }
+
+    RWMutexStatsSnapshot stats() const
+    {
+        RWMutexStatsSnapshot s;
+        for (auto& shard : m_shards) {
+            s.readAcquisitions += shard.readAcquisitions.load(std::memory_order_relaxed);
+            s.readContended += shard.readContended.load(std::memory_order_relaxed);
+            s.writeAcquisitions += shard.writeAcquisitions.load(std::memory_order_relaxed);
+            s.writeContended += shard.writeContended.load(std::memory_order_relaxed);
+            auto readers = shard.maxReaders.load(std::memory_order_relaxed);
+            if (readers > s.maxReaders) {
+                s.maxReaders = readers;
+            }
+            for (std::size_t i = 0; i < RWMutexStatsSnapshot::Buckets; ++i) {
+                s.readWait[i] += shard.readWait[i].load(std::memory_order_relaxed);
+                s.readHold[i] += shard.readHold[i].load(std::memory_order_relaxed);
+                s.writeWait[i] += shard.writeWait[i].load(std::memory_order_relaxed);
+                s.writeHold[i] += shard.writeHold[i].load(std::memory_order_relaxed);
+            }
+        }
+        return s;
+    }
+
+private:
+    static constexpr std::size_t MaxHeld = 16;
+    using Counter = std::atomic<uint64_t>;
+    using Histogram = std::array<Counter, RWMutexStatsSnapshot::Buckets>;
+
+    struct alignas(detail::CacheLineSize) Shard {
+        Counter readAcquisitions { 0 };
+        Counter readContended { 0 };
+        Counter writeAcquisitions { 0 };
+        Counter writeContended { 0 };
+        Counter maxReaders { 0 };
+        Histogram readWait {};
+        Histogram readHold {};
+        Histogram writeWait {};
+        Histogram writeHold {};
+    };
+    // acquisition times of the locks held by the calling thread, shared by
+    // all the mutexes
+    struct Held {
+        struct Entry {
+            const void* owner;
+            Clock::time_point start;
+        };
+        Entry entries[MaxHeld];
+        std::size_t size = 0;
+    };
+
+    // the shard is mostly used by a single thread, a relaxed increment on it
+    // does not bounce between cores
+    static void add(Counter& counter)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+    static std::size_t bucket(Clock::duration duration)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                      .count();
+        std::size_t b = 0;
+        while (ns > 0 && b < RWMutexStatsSnapshot::Buckets - 1) {
+            ns >>= 1;
+            ++b;
+        }
+        return b;
+    }
+    Shard& shard()
+    {
+        return m_shards[detail::thread_index() % ShardCount];
+    }
+    static Held& held()
+    {
+        thread_local static Held h;
+        return h;
+    }
+    void push(Clock::time_point start)
+    {
+        auto& h = held();
+        if (h.size == MaxHeld) {
+            return;
+        }
+        h.entries[h.size++] = { this, start };
+    }
+    // the most recent lock of this mutex is released first
+    bool pop(Clock::time_point& start)
+    {
+        auto& h = held();
+        for (auto i = h.size; i > 0; --i) {
+            if (h.entries[i - 1].owner == this) {
+                start = h.entries[i - 1].start;
+                for (auto j = i; j < h.size; ++j) {
+                    h.entries[j - 1] = h.entries[j];
+                }
+                --h.size;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Shard m_shards[ShardCount];
+};
+
+using RWMutexStats = RWMutexStatsImpl<>;
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_STATS_H_
@@ -0,0 +1,367 @@
+#ifndef HSQR_RWMUTEX_TRACE_H_
+#define HSQR_RWMUTEX_TRACE_H_
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hsqr/platform.h"
+
+namespace hsqr {
+
+namespace detail {
+
+    // cpu timestamp counter, or steady clock nanoseconds where there is none
+    inline uint64_t trace_clock()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // lock events of every RWMutexImpl using the RWMutexTracing policy. each
+    // thread appends to its own ring of the last RingSize events, without
+    // locks; a ring is given back when its thread exits and reused by the
+    // next new thread
+    class TraceDomain {
+    public:
+        enum Kind : uint32_t {
+            ReadRequest,
+            WriteRequest,
+            Abandoned,
+            ReadAcquired,
+            WriteAcquired,
+            ReadReleased,
+            WriteReleased
+        };
+        struct Event {
+            uint64_t clock;
+            const void* mutex;
+            uint32_t thread;
+            Kind kind;
+        };
+        static constexpr std::size_t RingSize = 8192;
+
+        static TraceDomain& instance()
+        {
+            static TraceDomain domain;
+            return domain;
+        }
+        TraceDomain(const TraceDomain&) = delete;
+        TraceDomain& operator=(const TraceDomain&) = delete;
+        TraceDomain(TraceDomain&&) = delete;
+        TraceDomain& operator=(TraceDomain&&) = delete;
+
+        // the only check on the lock path while tracing is off
+        static bool enabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+        void enable(bool on)
+        {
+            if (on) {
+                calibrate();
+            }
+            s_enabled.store(on, std::memory_order_relaxed);
+        }
+        void record(const void* mutex, Kind kind, uint64_t clock)
+        {
+            auto& ring = *local().ring;
+            auto head = ring.head.load(std::memory_order_relaxed);
+            auto& slot = ring.events[head % RingSize];
+            slot.clock.store(clock, std::memory_order_relaxed);
+            slot.mutex.store(mutex, std::memory_order_relaxed);
+            slot.info.store((uint64_t(detail::thread_index()) << 32) | kind,
+                std::memory_order_relaxed);
+            ring.head.store(head + 1, std::memory_order_release);
+        }
+        // events of all the threads. rings written while this runs may give
+        // torn events, disable tracing first for an exact copy
+        std::vector<Event> events()
+        {
+            std::vector<Event> events;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& ring : m_rings) {
+                auto head = ring->head.load(std::memory_order_acquire);
+                auto begin = head > RingSize ? head - RingSize : 0;
+                for (auto i = begin; i < head; ++i) {
+                    auto& slot = ring->events[i % RingSize];
+                    auto info = slot.info.load(std::memory_order_relaxed);
+                    events.push_back({ slot.clock.load(std::memory_order_relaxed),
+                        slot.mutex.load(std::memory_order_relaxed),
+                        static_cast<uint32_t>(info >> 32),
+                        static_cast<Kind>(info & 0xffffffff) });
+                }
+            }
+            return events;
+        }
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& ring : m_rings) {
+                ring->head.store(0, std::memory_order_relaxed);
+            }
+        }
+        // trace clock ticks per microsecond, measured between enable() and now
+        double ticks_per_us()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+#if defined(__x86_64__) || defined(__i386__)
+            auto us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - m_calibrationTime)
+                          .count();
+            auto ticks = static_cast<double>(trace_clock() - m_calibrationClock);
+            return us > 0 && ticks > 0 ? ticks / us : 1;
+#else
+            return 1000;
+#endif
+        }
+
+    private:
+        TraceDomain() = default;
+
+        struct Slot {
+            std::atomic<uint64_t> clock { 0 };
+            std::atomic<const void*> mutex { nullptr };
+            // thread << 32 | kind
+            std::atomic<uint64_t> info { 0 };
+        };
+        struct alignas(CacheLineSize) Ring {
+            std::atomic<uint64_t> head { 0 };
+            std::atomic<bool> used { true };
+            Slot events[RingSize];
+        };
+        struct Local {
+            Ring* ring;
+            ~Local()
+            {
+                ring->used.store(false, std::memory_order_release);
+            }
+        };
+
+        Local& local()
+        {
+            thread_local static Local local { acquire_ring() };
+            return local;
+        }
+        Ring* acquire_ring()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& ring : m_rings) {
+                bool used = false;
+                if (ring->used.compare_exchange_strong(used, true)) {
+                    return ring.get();
+                }
+            }
+            m_rings.push_back(std::make_unique<Ring>());
+            return m_rings.back().get();
+        }
+        void calibrate()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_calibrationTime = std::chrono::steady_clock::now();
+            m_calibrationClock = trace_clock();
+        }
+
+        static inline std::atomic<bool> s_enabled { false };
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<Ring>> m_rings;
+        std::chrono::steady_clock::time_point m_calibrationTime;
+        uint64_t m_calibrationClock = 0;
+    };
+
+} // namespace detail
+
+// statistics policy of RWMutexImpl (see rwmutex-stats.h) that records every
+// lock request, acquisition and release in the trace, under the address of
+// the mutex. the request is recorded when the wait starts, a thread that is
+// still blocked shows up in the trace. while tracing is off each hook costs
+// one branch on a global flag.
+class RWMutexTracing {
+public:
+    struct Timer {
+        // 0 if the request was not recorded
+        uint64_t clock = 0;
+    };
+
+    explicit RWMutexTracing(const void* mutex)
+        : m_mutex(mutex)
+    {
+    }
+
+    Timer start(bool write)
+    {
+        if (!detail::TraceDomain::enabled()) {
+            return {};
+        }
+        auto now = detail::trace_clock();
+        record(write ? detail::TraceDomain::WriteRequest
+                     : detail::TraceDomain::ReadRequest,
+            now);
+        return { now };
+    }
+    // a recorded request is always closed, even if tracing was turned off
+    // in the mean time
+    void abandoned(const Timer& timer)
+    {
+        if (timer.clock != 0) {
+            record(detail::TraceDomain::Abandoned, detail::trace_clock());
+        }
+    }
+    void read_locked(const Timer& timer, bool, uint64_t)
+    {
+        if (timer.clock != 0 || detail::TraceDomain::enabled()) {
+            record(detail::TraceDomain::ReadAcquired, detail::trace_clock());
+        }
+    }
+    void read_unlocked()
+    {
+        if (detail::TraceDomain::enabled()) {
+            record(detail::TraceDomain::ReadReleased, detail::trace_clock());
+        }
+    }
+    void write_locked(const Timer& timer, bool)
+    {
+        if (timer.clock != 0 || detail::TraceDomain::enabled()) {
+            record(detail::TraceDomain::WriteAcquired, detail::trace_clock());
+        }
+    }
+    void write_unlocked()
+    {
+        if (detail::TraceDomain::enabled()) {
+            record(detail::TraceDomain::WriteReleased, detail::trace_clock());
+        }
+    }
+
+private:
+    void record(detail::TraceDomain::Kind kind, uint64_t clock)
+    {
+        detail::TraceDomain::instance().record(m_mutex, kind, clock);
+    }
+
+    const void* m_mutex;
+};
+
+// runtime switch and export of the lock trace
+struct RWMutexTrace {
+    static void enable() { detail::TraceDomain::instance().enable(true); }
+    static void disable() { detail::TraceDomain::instance().enable(false); }
+    static void clear() { detail::TraceDomain::instance().clear(); }
+
+    // write the trace in the Chrome trace event format, readable by
+    // chrome://tracing and Perfetto. every acquisition gives a "read wait" or
+    // "write wait" slice from the request to the acquisition, and a "read
+    // hold" or "write hold" slice until the release, on the thread that took
+    // the lock, with the mutex address in the arguments. a try or timed lock
+    // that gave up gives a wait slice marked "abandoned", a thread still
+    // waiting gives a wait slice until now marked "blocked". events whose
+    // pair was overwritten in the ring are dropped.
+    static void dump(std::ostream& out)
+    {
+        using Domain = detail::TraceDomain;
+        auto& domain = Domain::instance();
+        auto events = domain.events();
+        auto ticks = domain.ticks_per_us();
+        std::stable_sort(events.begin(), events.end(),
+            [](const Domain::Event& a, const Domain::Event& b) {
+                return a.thread != b.thread ? a.thread < b.thread
+                                            : a.clock < b.clock;
+            });
+        auto now = detail::trace_clock();
+        uint64_t origin = now;
+        for (auto& e : events) {
+            origin = std::min(origin, e.clock);
+        }
+
+        bool first = true;
+        auto slice = [&](const char* name, const Domain::Event& begin,
+                         uint64_t end, const char* mark = nullptr) {
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << name
+                << "\",\"cat\":\"hsqr\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                << begin.thread << ",\"ts\":" << (begin.clock - origin) / ticks
+                << ",\"dur\":" << (end - begin.clock) / ticks
+                << ",\"args\":{\"mutex\":\"" << begin.mutex << "\"";
+            if (mark != nullptr) {
+                out << ",\"" << mark << "\":true";
+            }
+            out << "}}";
+            first = false;
+        };
+        auto isRequest = [](const std::vector<Domain::Event>& stack) {
+            return !stack.empty()
+                && (stack.back().kind == Domain::ReadRequest
+                    || stack.back().kind == Domain::WriteRequest);
+        };
+        auto waitName = [](Domain::Kind request) {
+            return request == Domain::ReadRequest ? "read wait" : "write wait";
+        };
+
+        out << "{\"traceEvents\":[";
+        // open requests and holds per thread and mutex
+        std::map<std::pair<uint32_t, const void*>, std::vector<Domain::Event>> open;
+        for (auto& e : events) {
+            auto& stack = open[{ e.thread, e.mutex }];
+            switch (e.kind) {
+            case Domain::ReadRequest:
+            case Domain::WriteRequest:
+                stack.push_back(e);
+                break;
+            case Domain::Abandoned:
+                if (isRequest(stack)) {
+                    slice(waitName(stack.back().kind), stack.back(), e.clock,
+                        "abandoned");
+                    stack.pop_back();
+                }
+                break;
+            case Domain::ReadAcquired:
+            case Domain::WriteAcquired:
+                if (isRequest(stack)) {
+                    slice(waitName(stack.back().kind), stack.back(), e.clock);
+                    stack.pop_back();
+                }
+                stack.push_back(e);
+                break;
+            case Domain::ReadReleased:
+            case Domain::WriteReleased:
+                auto acquired = e.kind == Domain::ReadReleased ? Domain::ReadAcquired
+                                                               : Domain::WriteAcquired;
+                if (!stack.empty() && stack.back().kind == acquired) {
+                    slice(acquired == Domain::ReadAcquired ? "read hold" : "write hold",
+                        stack.back(), e.clock);
+                    stack.pop_back();
+                }
+                break;
+            }
+        }
+        // requests not granted yet
+        for (auto& entry : open) {
+            for (auto& e : entry.second) {
+                if (e.kind == Domain::ReadRequest || e.kind == Domain::WriteRequest) {
+                    slice(waitName(e.kind), e, now, "blocked");
+                }
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+};
+
+} // namespace hsqr
+
+#endif // HSQR_RWMUTEX_TRACE_H_
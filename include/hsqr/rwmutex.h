@@ -5,10 +5,19 @@
 
 #include <atomic>
 #include <cassert>
-#include <mutex>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 
+#include "hsqr/futex.h"
+#include "hsqr/rwmutex-backoff.h"
 #include "hsqr/rwmutex-deadlock-detector.h"
+#include "hsqr/rwmutex-fairness.h"
+#include "hsqr/rwmutex-handoff.h"
+#include "hsqr/rwmutex-stats.h"
 
 namespace hsqr {
 
@@ -16,20 +25,35 @@ namespace test {
     struct RWMutexDiag;
 };
 
-template <typename DeadLockDetector_T>
+// defined in lock-all.h
+template <typename M, bool Write>
+class RWMutexIntent;
+
+// the fairness policy decides who goes first when readers and writers
+// compete, see rwmutex-fairness.h. the statistics policy records
+// acquisitions and wait and hold times, see rwmutex-stats.h. the backoff
+// policy decides how long a blocked thread spins before it parks, see
+// rwmutex-backoff.h
+template <typename DeadLockDetector_T,
+    typename Fairness_T = RWMutexWriterPreferring,
+    typename Stats_T = RWMutexNullStats,
+    typename Backoff_T = RWMutexAdaptiveBackoff>
 class RWMutexImpl {
     friend struct hsqr::test::RWMutexDiag;
 
 public:
+    using DeadLockDetector = DeadLockDetector_T;
+
     RWMutexImpl() noexcept
         : m_deadlockDetector(this)
+        , m_stats(this)
     {
     }
     ~RWMutexImpl() noexcept
     {
-        auto counter = m_counter.load();
-        assert(counter.reads == 0);
-        assert(counter.write == Counter::WriteNone);
+        auto state = m_state.load();
+        assert((state & ReaderMask) == 0);
+        assert((state & (WriteWaiting | WriteOwned | Upgradable)) == 0);
     }
 
     RWMutexImpl(const RWMutexImpl&) = delete;
@@ -40,107 +64,623 @@ public:
     // wait if has a writer. then increment the read counter and return
     void read_lock()
     {
-        if (m_deadlockDetector.can_read_lock() == false) {
-            throw std::logic_error(
-                "Not allowed to mix read and write locks on the same thread");
+        check_read_lock();
+        auto timer = m_stats.start(false);
+        bool contended = false;
+        auto state = acquire_read(nullptr, contended);
+        m_deadlockDetector.read_locked();
+        m_stats.read_locked(timer, contended, state & ReaderMask);
+    }
+    // increment the read counter if there is no writer, never waits
+    bool try_read_lock()
+    {
+        check_try_read_lock();
+        auto timer = m_stats.start(false);
+        auto state = m_state.load(std::memory_order_relaxed);
+        while (!Fairness_T::reader_blocked(state)) {
+            if (m_state.compare_exchange_weak(state, state + ReaderOne,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                check_reader_phase(state + ReaderOne);
+                m_deadlockDetector.read_locked();
+                m_stats.read_locked(timer, false, (state & ReaderMask) + 1);
+                return true;
+            }
         }
-
+        m_stats.abandoned(timer);
+        return false;
+    }
+    template <typename Rep, typename Period>
+    bool try_read_lock_for(const std::chrono::duration<Rep, Period>& duration)
+    {
+        return try_read_lock_until(std::chrono::steady_clock::now() + duration);
+    }
+    // same as read_lock, but gives up when the deadline passes
+    template <typename Clock, typename Duration>
+    bool try_read_lock_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        check_try_read_lock();
+        auto steadyDeadline = to_steady(deadline);
+        auto timer = m_stats.start(false);
+        bool contended = false;
+        auto state = acquire_read(&steadyDeadline, contended);
+        if (state == 0) {
+            m_stats.abandoned(timer);
+            return false;
+        }
+        m_deadlockDetector.read_locked();
+        m_stats.read_locked(timer, contended, state & ReaderMask);
+        return true;
+    }
+    // decrement the read counter, wake the waiting writer if it was the last
+    // reader
+    void read_unlock()
+    {
+        auto spinner = m_backoff.start();
+        auto state = m_state.load(std::memory_order_relaxed);
         while (true) {
-            auto counter = m_counter.load();
-            if (counter.write != Counter::WriteNone) {
-                // wait for lock
-                std::lock_guard<std::mutex> lock(m_mutex);
-            } else {
-                if (m_counter.compare_exchange_weak(
-                        counter, Counter { counter.reads + 1, Counter::WriteNone })) {
-                    // done
-                    m_deadlockDetector.read_locked();
+            if ((state & ReaderMask) == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+            if (m_state.compare_exchange_weak(state, state - ReaderOne,
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                break;
+            }
+            m_backoff.collided(spinner);
+        }
+        m_deadlockDetector.read_unlocked();
+        m_stats.read_unlocked();
+        if ((state & ReaderMask) == ReaderOne && (state & WriteWaiting) != 0) {
+            detail::futex_wake(detail::futex_low_word(m_state), 1);
+        }
+    }
+    // wait if already has a writer, then set the write waiting flag so no new
+    // reader can enter, then wait for the reads to go to zero and take the
+    // ownership
+    void write_lock()
+    {
+        check_write_lock();
+        auto timer = m_stats.start(true);
+        bool contended = false;
+        acquire_write(nullptr, contended);
+        m_deadlockDetector.write_locked();
+        m_stats.write_locked(timer, contended);
+    }
+    // take the ownership if there is no reader and no writer, never waits
+    bool try_write_lock()
+    {
+        check_try_write_lock();
+        auto timer = m_stats.start(true);
+        auto state = m_state.load(std::memory_order_relaxed);
+        while ((state & (ReaderMask | WriterBlocked)) == 0) {
+            if (m_state.compare_exchange_weak(state, state | WriteOwned,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                m_deadlockDetector.write_locked();
+                m_stats.write_locked(timer, false);
+                return true;
+            }
+        }
+        m_stats.abandoned(timer);
+        return false;
+    }
+    template <typename Rep, typename Period>
+    bool try_write_lock_for(const std::chrono::duration<Rep, Period>& duration)
+    {
+        return try_write_lock_until(std::chrono::steady_clock::now() + duration);
+    }
+    // same as write_lock, but gives up when the deadline passes. if the
+    // deadline passes while waiting for the readers the write waiting flag
+    // is withdrawn and the readers blocked by it are woken up
+    template <typename Clock, typename Duration>
+    bool try_write_lock_until(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        check_try_write_lock();
+        auto steadyDeadline = to_steady(deadline);
+        auto timer = m_stats.start(true);
+        bool contended = false;
+        if (!acquire_write(&steadyDeadline, contended)) {
+            m_stats.abandoned(timer);
+            return false;
+        }
+        m_deadlockDetector.write_locked();
+        m_stats.write_locked(timer, contended);
+        return true;
+    }
+    // lock requests for lock_all(), see lock-all.h
+    RWMutexIntent<RWMutexImpl, false> read_intent()
+    {
+        return RWMutexIntent<RWMutexImpl, false>(*this);
+    }
+    RWMutexIntent<RWMutexImpl, true> write_intent()
+    {
+        return RWMutexIntent<RWMutexImpl, true>(*this);
+    }
+    // totals of the statistics policy, only for policies that record them
+    RWMutexStatsSnapshot stats() const
+    {
+        return m_stats.stats();
+    }
+    // take the upgradable lock: a read lock that excludes writers and other
+    // upgradable holders but not readers, and that can be upgraded to a
+    // write lock without being released
+    void upgradable_lock()
+    {
+        check_read_lock();
+        auto timer = m_stats.start(false);
+        auto spinner = m_backoff.start();
+        bool contended = false;
+        auto state = m_state.load(std::memory_order_relaxed);
+        while (true) {
+            if ((state & (WriteWaiting | WriteOwned | Upgradable)) == 0) {
+                if (m_state.compare_exchange_weak(state,
+                        (state + ReaderOne) | Upgradable,
+                        std::memory_order_acquire)) {
                     break;
                 }
-                // we have to re-try
+                m_backoff.collided(spinner);
+                continue;
             }
+            contended = true;
+            if (m_backoff.spin(spinner)) {
+                state = m_state.load(std::memory_order_relaxed);
+                continue;
+            }
+            // wait with the writers, they compete for the same slot
+            state = park(state, ParkedWriterOne, ParkedWriterMask,
+                detail::FutexWaitWriters, nullptr);
         }
+        m_backoff.acquired(spinner);
+        m_deadlockDetector.read_locked();
+        m_stats.read_locked(timer, contended, (state & ReaderMask) + 1);
     }
-    // decrement the read counter
-    void read_unlock()
+    void upgradable_unlock()
+    {
+        auto release = [](uint64_t state) {
+            return (state - ReaderOne) & ~Upgradable;
+        };
+        auto state = m_state.load(std::memory_order_relaxed);
+        bool handedOff = false;
+        do {
+            if ((state & Upgradable) == 0 || (state & ReaderMask) == 0) {
+                throw std::logic_error("Invalid call to unlock");
+            }
+            if (hand_off(state, release)) {
+                handedOff = true;
+                break;
+            }
+        } while (!m_state.compare_exchange_weak(state, release(state),
+            std::memory_order_release, std::memory_order_relaxed));
+        m_deadlockDetector.read_unlocked();
+        m_stats.read_unlocked();
+        if (!handedOff) {
+            wake_parked(state);
+        }
+    }
+    // turn the upgradable lock into a write lock. no other writer can get in
+    // between, the call only waits for the plain readers to leave
+    void upgrade()
+    {
+        // validated before the detector drops the read lock of the thread
+        auto state = m_state.load(std::memory_order_relaxed);
+        if ((state & Upgradable) == 0 || (state & ReaderMask) == 0) {
+            throw std::logic_error("Invalid call to upgrade");
+        }
+        m_deadlockDetector.read_unlocked();
+        if (m_deadlockDetector.can_write_lock() == false) {
+            m_deadlockDetector.read_locked();
+            throw std::logic_error(
+                "Not allowed to upgrade while holding other read locks");
+        }
+        do {
+            if ((state & Upgradable) == 0 || (state & ReaderMask) == 0) {
+                m_deadlockDetector.read_locked();
+                throw std::logic_error("Invalid call to upgrade");
+            }
+        } while (!m_state.compare_exchange_weak(state,
+            ((state - ReaderOne) & ~Upgradable) | WriteWaiting,
+            std::memory_order_acquire, std::memory_order_relaxed));
+        m_stats.read_unlocked();
+        auto timer = m_stats.start(true);
+        auto spinner = m_backoff.start();
+        bool contended = false;
+        drain_readers(((state - ReaderOne) & ~Upgradable) | WriteWaiting,
+            nullptr, spinner, contended);
+        m_backoff.acquired(spinner);
+        m_deadlockDetector.write_locked();
+        m_stats.write_locked(timer, contended);
+    }
+    // turn the write lock into a read lock without letting another writer in
+    void downgrade()
+    {
+        auto release = [](uint64_t state) {
+            return ((state & ~WriteOwned) + ReaderOne) | reader_phase(state);
+        };
+        auto state = m_state.load(std::memory_order_relaxed);
+        bool handedOff = false;
+        do {
+            if ((state & WriteOwned) == 0 || (state & ReaderMask) != 0) {
+                throw std::logic_error("Invalid call to downgrade");
+            }
+            if (hand_off(state, release)) {
+                handedOff = true;
+                break;
+            }
+        } while (!m_state.compare_exchange_weak(state, release(state),
+            std::memory_order_release, std::memory_order_relaxed));
+        m_deadlockDetector.write_unlocked();
+        m_deadlockDetector.read_locked();
+        m_stats.write_unlocked();
+        m_stats.read_locked(m_stats.start(false), false, 1);
+        if (!handedOff) {
+            wake_released(state);
+        }
+    }
+    // clear the writer flag then wake the parked threads, if any. with a
+    // handoff policy the lock goes to the most urgent queued writer instead
+    void write_unlock()
     {
+        auto release = [](uint64_t state) {
+            return (state & ~WriteOwned) | reader_phase(state);
+        };
+        auto spinner = m_backoff.start();
+        auto state = m_state.load(std::memory_order_relaxed);
+        bool handedOff = false;
         while (true) {
-            auto counter = m_counter.load();
-            if (counter.reads == 0) {
+            if ((state & WriteOwned) == 0 || (state & ReaderMask) != 0) {
                 throw std::logic_error("Invalid call to unlock");
             }
-            if (m_counter.compare_exchange_weak(
-                    counter, Counter { counter.reads - 1, counter.write })) {
-                m_deadlockDetector.read_unlocked();
+            if (hand_off(state, release)) {
+                handedOff = true;
                 break;
             }
+            if (m_state.compare_exchange_weak(state, release(state),
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                break;
+            }
+            m_backoff.collided(spinner);
+        }
+        m_deadlockDetector.write_unlocked();
+        m_stats.write_unlocked();
+        if (!handedOff) {
+            wake_released(state);
         }
     }
-    // wait if already has a writer or has one or more readers. then lock mutex
-    // and set the writer flag to true
-    void write_lock()
+
+private:
+    using Deadline = detail::FutexDeadline;
+
+    // see detail::RWMutexState for the layout of the state word
+    using State = detail::RWMutexState;
+    static constexpr uint64_t ReaderOne = State::ReaderOne;
+    static constexpr uint64_t ReaderMask = State::ReaderMask;
+    static constexpr uint64_t WriteOwned = State::WriteOwned;
+    static constexpr uint64_t WriteWaiting = State::WriteWaiting;
+    static constexpr uint64_t Upgradable = State::Upgradable;
+    static constexpr uint64_t ReaderPhase = State::ReaderPhase;
+    static constexpr uint64_t HandoffQueued = State::HandoffQueued;
+    static constexpr uint64_t ParkedReaderOne = State::ParkedReaderOne;
+    static constexpr uint64_t ParkedReaderMask = State::ParkedReaderMask;
+    static constexpr uint64_t ParkedWriterOne = State::ParkedWriterOne;
+    static constexpr uint64_t ParkedWriterMask = State::ParkedWriterMask;
+    // a writer can not claim the lock while any of these is set
+    static constexpr uint64_t WriterBlocked = WriteOwned | WriteWaiting
+        | Upgradable | ReaderPhase;
+
+    void check_read_lock()
+    {
+        if (m_deadlockDetector.can_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_write_lock()
     {
         if (m_deadlockDetector.can_write_lock() == false) {
             throw std::logic_error(
                 "Not allowed to mix read and write locks on the same thread");
         }
+    }
+    // a try or timed lock can not dead lock, it does not check the order
+    void check_try_read_lock()
+    {
+        if (m_deadlockDetector.can_try_read_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    void check_try_write_lock()
+    {
+        if (m_deadlockDetector.can_try_write_lock() == false) {
+            throw std::logic_error(
+                "Not allowed to mix read and write locks on the same thread");
+        }
+    }
+    template <typename Clock, typename Duration>
+    static Deadline to_steady(
+        const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        if constexpr (std::is_same<Clock, std::chrono::steady_clock>::value) {
+            return std::chrono::ceil<Deadline::duration>(deadline);
+        } else {
+            return std::chrono::steady_clock::now()
+                + std::chrono::ceil<Deadline::duration>(deadline - Clock::now());
+        }
+    }
+    static bool expired(const Deadline* deadline)
+    {
+        return deadline != nullptr
+            && std::chrono::steady_clock::now() >= *deadline;
+    }
 
-        // first lock the mutex
-        m_mutex.lock();
-        // second set the write counter
+    // returns the state after the read counter was incremented, or zero if
+    // the deadline passed before the lock was taken
+    uint64_t acquire_read(const Deadline* deadline, bool& contended)
+    {
+        auto spinner = m_backoff.start();
+        auto state = m_state.load(std::memory_order_relaxed);
         while (true) {
-            auto counter = m_counter.load();
-            if (m_counter.compare_exchange_weak(
-                    counter, Counter { counter.reads, Counter::WriteWaiting })) {
-                m_deadlockDetector.write_locked();
-                break;
+            if (!Fairness_T::reader_blocked(state)) {
+                if (m_state.compare_exchange_weak(state, state + ReaderOne,
+                        std::memory_order_acquire)) {
+                    check_reader_phase(state + ReaderOne);
+                    m_backoff.acquired(spinner);
+                    return state + ReaderOne;
+                }
+                // we have to re-try
+                m_backoff.collided(spinner);
+                continue;
             }
+            if (expired(deadline)) {
+                check_reader_phase(m_state.load(std::memory_order_relaxed));
+                return 0;
+            }
+            contended = true;
+            if (m_backoff.spin(spinner)) {
+                state = m_state.load(std::memory_order_relaxed);
+                continue;
+            }
+            // has a writer, park on the high word until it is released
+            state = park(state, ParkedReaderOne, ParkedReaderMask,
+                detail::FutexWaitReaders, deadline);
+        }
+    }
+    // returns false if the deadline passed before the lock was taken
+    bool acquire_write(const Deadline* deadline, bool& contended)
+    {
+        auto spinner = m_backoff.start();
+        // first claim the writer slot
+        auto state = m_state.load(std::memory_order_relaxed);
+        while (true) {
+            if ((state & WriterBlocked) == 0) {
+                if (m_state.compare_exchange_weak(state, state | WriteWaiting,
+                        std::memory_order_acquire)) {
+                    break;
+                }
+                m_backoff.collided(spinner);
+                continue;
+            }
+            if (expired(deadline)) {
+                // we may have been the one woken up by a release, pass it on
+                wake_parked(state);
+                return false;
+            }
+            contended = true;
+            if (m_backoff.spin(spinner)) {
+                state = m_state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if constexpr (Fairness_T::Handoff) {
+                auto queued = wait_handoff(state, deadline);
+                if (queued == Handoff::Granted) {
+                    // the releasing thread passed us the write waiting flag
+                    state = m_state.load(std::memory_order_relaxed);
+                    break;
+                }
+                if (queued == Handoff::TimedOut) {
+                    return false;
+                }
+                state = m_state.load(std::memory_order_relaxed);
+                continue;
+            }
+            state = park(state, ParkedWriterOne, ParkedWriterMask,
+                detail::FutexWaitWriters, deadline);
         }
         // then wait for reads to go to zero
+        if (!drain_readers(state | WriteWaiting, deadline, spinner, contended)) {
+            return false;
+        }
+        m_backoff.acquired(spinner);
+        return true;
+    }
+    // wait for the readers to leave while holding the write waiting flag
+    bool drain_readers(uint64_t state, const Deadline* deadline,
+        typename Backoff_T::Spinner& spinner, bool& contended)
+    {
         while (true) {
-            auto expected = Counter(0, Counter::WriteWaiting);
-            if (m_counter.compare_exchange_weak(expected,
-                    Counter(0, Counter::WriteOwned))) {
-                break;
+            if ((state & ReaderMask) == 0) {
+                if (m_state.compare_exchange_weak(state,
+                        (state & ~WriteWaiting) | WriteOwned,
+                        std::memory_order_acquire)) {
+                    return true;
+                }
+                continue;
+            }
+            if (expired(deadline)) {
+                // give the claim back, or to the next queued writer
+                auto release = [](uint64_t state) { return state & ~WriteWaiting; };
+                while (!hand_off(state, release)) {
+                    if (m_state.compare_exchange_weak(state, release(state),
+                            std::memory_order_relaxed)) {
+                        wake_parked(state);
+                        break;
+                    }
+                }
+                return false;
+            }
+            contended = true;
+            if (m_backoff.spin(spinner)) {
+                state = m_state.load(std::memory_order_relaxed);
+                continue;
             }
-            // spin lock (this could changed to a cv)
+            // the last reader wakes us up through the low word
+            detail::futex_wait(detail::futex_low_word(m_state),
+                static_cast<uint32_t>(state & ReaderMask), detail::FutexWaitAny,
+                deadline);
+            state = m_state.load(std::memory_order_relaxed);
+        }
+    }
+    enum class Handoff {
+        Granted,
+        TimedOut,
+        NotQueued
+    };
+    // queue for a handoff of the writer side, with the priority of the
+    // thread. only queues while the writer side is held, its holder then
+    // sees the queued flag when it releases
+    Handoff wait_handoff(uint64_t state, const Deadline* deadline)
+    {
+        auto& queue = detail::HandoffQueue::of(this);
+        detail::HandoffQueue::Waiter waiter { this, RWMutexPriority::current() };
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex());
+            do {
+                if ((state & WriterBlocked) == 0) {
+                    return Handoff::NotQueued;
+                }
+            } while (!m_state.compare_exchange_weak(state, state | HandoffQueued,
+                std::memory_order_relaxed));
+            queue.insert(&waiter);
+        }
+        while (waiter.granted.load(std::memory_order_acquire) == 0) {
+            if (expired(deadline)) {
+                std::lock_guard<std::mutex> lock(queue.mutex());
+                if (waiter.granted.load(std::memory_order_acquire) != 0) {
+                    break;
+                }
+                queue.remove(&waiter);
+                if (!queue.has(this)) {
+                    // the holder of the writer side still blocks the others,
+                    // its release wakes them
+                    m_state.fetch_and(~HandoffQueued, std::memory_order_relaxed);
+                }
+                return Handoff::TimedOut;
+            }
+            detail::futex_wait(detail::futex_word(waiter.granted), 0,
+                detail::FutexWaitAny, deadline);
+        }
+        return Handoff::Granted;
+    }
+    // if writers are queued in the given state, replace it with
+    // release(state), pass the write waiting flag to the most urgent of them
+    // and return true. the waiter then waits for the readers itself. state is
+    // reloaded when it changed under us
+    template <typename Release>
+    bool hand_off(uint64_t& state, Release release)
+    {
+        if constexpr (Fairness_T::Handoff) {
+            if ((state & HandoffQueued) == 0) {
+                return false;
+            }
+            auto& queue = detail::HandoffQueue::of(this);
+            std::lock_guard<std::mutex> lock(queue.mutex());
+            auto waiter = queue.pop(this);
+            auto last = waiter == nullptr || !queue.has(this);
+            state = m_state.load(std::memory_order_relaxed);
+            if (waiter == nullptr) {
+                state = m_state.fetch_and(~HandoffQueued, std::memory_order_relaxed)
+                    & ~HandoffQueued;
+                return false;
+            }
+            while (!m_state.compare_exchange_weak(state,
+                (release(state) | WriteWaiting) & ~(last ? HandoffQueued : 0),
+                std::memory_order_release, std::memory_order_relaxed)) {
+            }
+            waiter->granted.store(1, std::memory_order_release);
+            detail::futex_wake(detail::futex_word(waiter->granted), 1);
+            return true;
+        } else {
+            (void)state;
+            (void)release;
+            return false;
+        }
+    }
+    // register as a parked waiter and sleep until the high word changes.
+    // returns the fresh state after the waiter is unregistered
+    uint64_t park(uint64_t state, uint64_t one, uint64_t mask, uint32_t wakeMask,
+        const Deadline* deadline)
+    {
+        if ((state & mask) == mask) {
+            // too many parked waiters to count, fall back to yield
             std::this_thread::yield();
+            return m_state.load(std::memory_order_relaxed);
+        }
+        if (!m_state.compare_exchange_weak(state, state + one,
+                std::memory_order_relaxed)) {
+            return state;
         }
+        state += one;
+        detail::futex_wait(detail::futex_high_word(m_state),
+            static_cast<uint32_t>(state >> 32), wakeMask, deadline);
+        return m_state.fetch_sub(one, std::memory_order_relaxed) - one;
     }
-    // set the writer flag to false then unlock mutex
-    void write_unlock()
+    // a write unlock opens a reader phase if the policy asks for it and
+    // readers are parked
+    static constexpr uint64_t reader_phase(uint64_t state)
     {
-        auto expected = Counter(0, Counter::WriteOwned);
-        if (!m_counter.compare_exchange_strong(expected,
-                Counter(0, Counter::WriteNone))) {
-            throw std::logic_error("Invalid call to unlock");
+        return Fairness_T::ReaderPhases && (state & ParkedReaderMask) != 0
+            ? ReaderPhase
+            : 0;
+    }
+    // close the reader phase once all the readers parked when it was opened
+    // have entered or given up, then let the next writer in
+    void check_reader_phase(uint64_t state)
+    {
+        if constexpr (Fairness_T::ReaderPhases) {
+            while ((state & ReaderPhase) != 0 && (state & ParkedReaderMask) == 0) {
+                if (m_state.compare_exchange_weak(state, state & ~ReaderPhase,
+                        std::memory_order_relaxed)) {
+                    if ((state & ParkedWriterMask) != 0) {
+                        detail::futex_wake(detail::futex_high_word(m_state), 1,
+                            detail::FutexWaitWriters);
+                    }
+                    break;
+                }
+            }
         }
-        m_deadlockDetector.write_unlocked();
-        m_mutex.unlock();
     }
-
-private:
-    struct Counter {
-        // use int 16 to make the struct an atomic lock free
-        enum WriteState : int16_t { WriteNone,
-            WriteWaiting,
-            WriteOwned };
-        Counter() noexcept
-            : reads(0)
-            , write(WriteNone)
-        {
+    // wake the threads a write unlock from the given state hands over to
+    void wake_released(uint64_t state)
+    {
+        if (Fairness_T::WritersFirst && (state & ParkedWriterMask) != 0) {
+            detail::futex_wake(detail::futex_high_word(m_state), 1,
+                detail::FutexWaitWriters);
+            return;
         }
-        Counter(int r, WriteState w)
-            : reads(r)
-            , write(w)
-        {
+        if (Fairness_T::ReaderPhases && (state & ParkedReaderMask) != 0) {
+            detail::futex_wake(detail::futex_high_word(m_state), INT_MAX,
+                detail::FutexWaitReaders);
+            return;
         }
-        uint16_t reads;
-        WriteState write;
-    };
-    std::atomic<Counter> m_counter;
-    std::mutex m_mutex;
+        wake_parked(state);
+    }
+    // wake the threads parked on the high word of the given state, if any
+    void wake_parked(uint64_t state)
+    {
+        if ((state & ParkedWriterMask) != 0) {
+            detail::futex_wake(detail::futex_high_word(m_state), 1,
+                detail::FutexWaitWriters);
+        }
+        if ((state & ParkedReaderMask) != 0) {
+            detail::futex_wake(detail::futex_high_word(m_state), INT_MAX,
+                detail::FutexWaitReaders);
+        }
+    }
+
+    std::atomic<uint64_t> m_state { 0 };
     DeadLockDetector_T m_deadlockDetector;
+    Stats_T m_stats;
+    Backoff_T m_backoff;
 };
 
 class RWMutexNullDeadLockDetector {
@@ -152,12 +692,14 @@ public:
     void write_unlocked() { }
     bool can_read_lock() { return true; }
     bool can_write_lock() { return true; }
+    bool can_try_read_lock() { return true; }
+    bool can_try_write_lock() { return true; }
 };
 
 using RWMutexUnchecked = RWMutexImpl<RWMutexNullDeadLockDetector>;
 using RWMutexChecked = RWMutexImpl<RWMutexDeadLockDetector>;
 
-#ifdef NDEBUG
+#ifndef NDEBUG
 using RWMutex = RWMutexChecked;
 #else
 using RWMutex = RWMutexUnchecked;
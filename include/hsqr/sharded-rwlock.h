@@ -0,0 +1,131 @@
+#ifndef HSQR_SHARDED_RWLOCK_H_
+#define HSQR_SHARDED_RWLOCK_H_
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "hsqr/platform.h"
+#include "hsqr/rwlock.h"
+
+namespace hsqr {
+
+// N independent RWLock<T> shards, a key picks its shard by hash. meant for
+// hash partitioned data, e.g. ShardedRWLock<std::unordered_map<K, V>>: the
+// per key guards only lock the shard of the key, so threads working on
+// different keys rarely contend. the shards are on separate cache lines.
+//
+// the whole structure operations lock every shard, always in index order,
+// so they do not dead lock with each other. do not hold a per key guard
+// while calling them.
+template <typename T, std::size_t N = 16, typename M = hsqr::RWMutex>
+class ShardedRWLock {
+    static_assert(N > 0, "ShardedRWLock needs at least one shard");
+
+public:
+    using Lock = RWLock<T, M>;
+    using ReadGuard = typename Lock::ReadGuard;
+    using WriteGuard = typename Lock::WriteGuard;
+
+    ShardedRWLock() = default;
+    ShardedRWLock(const ShardedRWLock&) = delete;
+    ShardedRWLock& operator=(const ShardedRWLock&) = delete;
+    ShardedRWLock(ShardedRWLock&&) = delete;
+    ShardedRWLock& operator=(ShardedRWLock&&) = delete;
+
+    static constexpr std::size_t size() { return N; }
+
+    // index of the shard holding the key. the hash is mixed first, so
+    // identity hashes of integers and aligned pointers spread evenly
+    template <typename Key, typename Hash = std::hash<Key>>
+    static std::size_t shard_index(const Key& key, const Hash& hash = Hash())
+    {
+        uint64_t h = static_cast<uint64_t>(hash(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return static_cast<std::size_t>(h % N);
+    }
+    template <typename Key, typename Hash = std::hash<Key>>
+    Lock& shard(const Key& key, const Hash& hash = Hash())
+    {
+        return m_shards[shard_index(key, hash)].lock;
+    }
+    Lock& shard_at(std::size_t index)
+    {
+        return m_shards[index].lock;
+    }
+
+    // lock the shard of the key
+    template <typename Key, typename Hash = std::hash<Key>>
+    ReadGuard read(const Key& key, const Hash& hash = Hash())
+    {
+        return shard(key, hash).read();
+    }
+    template <typename Key, typename Hash = std::hash<Key>>
+    WriteGuard write(const Key& key, const Hash& hash = Hash())
+    {
+        return shard(key, hash).write();
+    }
+
+    // lock every shard in index order, the guards are in the same order
+    std::vector<ReadGuard> read_all()
+    {
+        std::vector<ReadGuard> guards;
+        guards.reserve(N);
+        for (auto& shard : m_shards) {
+            guards.push_back(shard.lock.read());
+        }
+        return guards;
+    }
+    std::vector<WriteGuard> write_all()
+    {
+        std::vector<WriteGuard> guards;
+        guards.reserve(N);
+        for (auto& shard : m_shards) {
+            guards.push_back(shard.lock.write());
+        }
+        return guards;
+    }
+    // call fn(const T&) for every shard, all shards are read locked for the
+    // whole iteration so it sees a consistent state
+    template <typename F>
+    void for_each(F&& fn)
+    {
+        auto guards = read_all();
+        for (auto& guard : guards) {
+            fn(*guard);
+        }
+    }
+    // reset every shard to a default constructed value, atomically
+    void clear()
+    {
+        auto guards = write_all();
+        for (auto& guard : guards) {
+            *guard = T();
+        }
+    }
+    // copy of every shard, taken at a single point in time
+    std::vector<T> snapshot()
+    {
+        std::vector<T> values;
+        values.reserve(N);
+        for_each([&](const T& value) { values.push_back(value); });
+        return values;
+    }
+
+private:
+    struct alignas(detail::CacheLineSize) Shard {
+        Lock lock;
+    };
+
+    std::array<Shard, N> m_shards;
+};
+
+} // namespace hsqr
+
+#endif // HSQR_SHARDED_RWLOCK_H_
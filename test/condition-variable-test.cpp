@@ -0,0 +1,158 @@
+#include <cassert>
+#include <hsqr/condition-variable.h>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-compact.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+using namespace hsqr::test;
+
+struct hsqr::test::RWConditionVariableDiag {
+    static int GetWaiters(RWConditionVariable& cv)
+    {
+        return cv.m_readers.load() + cv.m_writers.load();
+    }
+};
+
+// wait until n threads sleep on the condition variable
+void wait_for_waiters(RWConditionVariable& cv, int n)
+{
+    while (RWConditionVariableDiag::GetWaiters(cv) != n) {
+        std::this_thread::yield();
+    }
+}
+
+void test_producer_consumer()
+{
+    RWLock<std::vector<int>> queue;
+    RWConditionVariable cv;
+    constexpr int N = 4;
+    constexpr int K = 2000;
+    std::atomic<int> sum { 0 };
+    std::vector<std::thread> v;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread([&]() {
+            for (int k = 0; k < K; ++k) {
+                auto w = queue.write();
+                cv.wait(w, [&]() { return !(*w).empty(); });
+                sum += (*w).back();
+                (*w).pop_back();
+            }
+        }));
+    }
+    for (int k = 0; k < N * K; ++k) {
+        (*queue.write()).push_back(1);
+        cv.notify_one();
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(sum == N * K);
+    assert((*queue.read()).empty());
+    assert(RWConditionVariableDiag::GetWaiters(cv) == 0);
+}
+
+// readers and writers wait for the same flag, one notify_all wakes them all
+void test_notify_all()
+{
+    RWLock<int, RWMutexUnchecked> lk(std::in_place, 0);
+    RWConditionVariable cv;
+    std::atomic<int> done { 0 };
+    std::vector<std::thread> v;
+    for (int i = 0; i < 8; ++i) {
+        v.push_back(std::thread([&, i]() {
+            if (i % 2 == 0) {
+                auto r = lk.read();
+                cv.wait(r, [&]() { return *r != 0; });
+            } else {
+                auto w = lk.write();
+                cv.wait(w, [&]() { return *w != 0; });
+                *w += 1;
+            }
+            ++done;
+        }));
+    }
+    wait_for_waiters(cv, 8);
+    *lk.write() = 1;
+    cv.notify_all();
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(done == 8);
+    assert(*lk.read() == 5);
+}
+
+void test_timeout()
+{
+    RWLock<int, RWMutexUnchecked> lk(std::in_place, 0);
+    RWConditionVariable cv;
+    auto w = lk.write();
+    auto start = std::chrono::steady_clock::now();
+    assert(cv.wait_for(w, std::chrono::milliseconds(10), [&]() { return *w != 0; })
+        == false);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(10));
+    // the guard holds the lock again
+    assert(lk.try_read().has_value() == false);
+    *w = 1;
+    assert(cv.wait_for(w, std::chrono::milliseconds(10), [&]() { return *w != 0; }));
+
+    auto r = std::move(w).downgrade();
+    auto deadline = std::chrono::system_clock::now() + std::chrono::milliseconds(10);
+    while (cv.wait_until(r, deadline) == std::cv_status::no_timeout) {
+    }
+    assert(std::chrono::system_clock::now() >= deadline);
+    assert(lk.try_write().has_value() == false);
+}
+
+void test_frozen_and_compact()
+{
+    RWLock<std::string> lk(std::in_place, "One");
+    RWConditionVariable cv;
+    lk.freeze();
+    std::thread reader([&]() {
+        auto r = lk.read();
+        cv.wait(r, [&]() { return *r == "Two"; });
+    });
+    wait_for_waiters(cv, 1);
+    // the waiting reader left the frozen read, the write does not wait for it
+    *lk.write() = "Two";
+    cv.notify_one();
+    reader.join();
+    assert(lk.frozen() == false);
+
+    // no write thawed the lock, the guard comes back as a frozen read
+    lk.freeze();
+    {
+        auto r = lk.read();
+        assert(cv.wait_for(r, std::chrono::milliseconds(10)) == std::cv_status::timeout);
+        assert(*r == "Two");
+        assert(lk.frozen());
+        // the frozen reader is still counted in
+        assert(lk.try_write().has_value() == false);
+    }
+    assert(lk.try_write().has_value());
+    assert(lk.frozen() == false);
+
+    RWLock<uint32_t, RWMutexCompactUnchecked, RWLockCompactStorage> compact;
+    std::thread writer([&]() {
+        auto w = compact.write();
+        cv.wait(w, [&]() { return *w == 1; });
+        *w = 2;
+    });
+    wait_for_waiters(cv, 1);
+    *compact.write() = 1;
+    cv.notify_all();
+    writer.join();
+    assert(*compact.read() == 2);
+}
+
+int main()
+{
+    test_producer_consumer();
+    test_notify_all();
+    test_timeout();
+    test_frozen_and_compact();
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <cassert>
+#include <hsqr/lock-all.h>
+#include <hsqr/rwlock.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+
+void test_transfer()
+{
+    RWLock<int> a(std::in_place, 1000);
+    RWLock<int> b(std::in_place, 1000);
+    constexpr int N = 10000;
+
+    // the two threads name the locks in opposite order
+    std::thread t([&]() {
+        for (int i = 0; i < N; ++i) {
+            auto [to, from] = lock_all(a.write_intent(), b.write_intent());
+            *to += 1;
+            *from -= 1;
+        }
+    });
+    for (int i = 0; i < N; ++i) {
+        auto [to, from] = lock_all(b.write_intent(), a.write_intent());
+        *to += 1;
+        *from -= 1;
+    }
+    t.join();
+
+    auto [ra, rb] = lock_all(a.read_intent(), b.read_intent());
+    assert(*ra + *rb == 2000);
+    assert(*ra == 1000);
+}
+
+void test_mixed()
+{
+    RWLock<int> lk(std::in_place, 1);
+    RWMutex m1;
+    RWMutexUnchecked m2;
+    {
+        auto [w, r1, r2] = lock_all(lk.write_intent(), m1.read_intent(),
+            write_intent(m2));
+        *w = 2;
+        assert(r1.mutex() == &m1);
+        // readers can still share m1
+        assert(m1.try_read_lock());
+        m1.read_unlock();
+    }
+    // everything was released
+    assert(lk.try_write().has_value());
+    assert(m1.try_write_lock());
+    m1.write_unlock();
+    assert(m2.try_write_lock());
+    m2.write_unlock();
+}
+
+void test_same_lock_twice()
+{
+    RWLock<int> lk;
+    bool thrown = false;
+    try {
+        lock_all(lk.read_intent(), lk.write_intent());
+    } catch (std::logic_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(lk.try_write().has_value());
+}
+
+int main()
+{
+    test_transfer();
+    test_mixed();
+    test_same_lock_twice();
+    return 0;
+}
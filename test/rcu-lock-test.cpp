@@ -0,0 +1,154 @@
+#include "hsqr/rcu-lock.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+
+struct Counted {
+    static std::atomic<int> alive;
+    Counted(int v = 0)
+        : value(v)
+    {
+        ++alive;
+    }
+    Counted(const Counted& other)
+        : value(other.value)
+    {
+        ++alive;
+    }
+    ~Counted()
+    {
+        --alive;
+    }
+    int value;
+};
+std::atomic<int> Counted::alive { 0 };
+
+// built before the domain, which is first used in main(), so destroyed after
+// it would be if the domain were a plain static
+RcuLock<std::string> static_lock(std::in_place, "static");
+
+void test_read_write()
+{
+    RcuLock<std::map<int, std::string>> lk;
+    {
+        auto v = lk.write();
+        (*v)[1] = "One";
+    }
+    auto snapshot = lk.read();
+    assert((*snapshot).at(1) == "One");
+    {
+        auto v = lk.write();
+        (*v)[1] = "Two";
+    }
+    // the old snapshot is not affected by the write
+    assert((*snapshot).at(1) == "One");
+    assert((*lk.read()).at(1) == "Two");
+}
+
+void test_write_exception()
+{
+    RcuLock<std::string> lk(std::in_place, "One");
+    try {
+        auto v = lk.write();
+        *v = "Two";
+        throw std::runtime_error("failed");
+    } catch (std::runtime_error&) {
+    }
+    assert(*lk.read() == "One");
+}
+
+void test_reclaim()
+{
+    {
+        RcuLock<Counted> lk(std::in_place, 1);
+        {
+            auto old = lk.read();
+            {
+                auto v = lk.write();
+                (*v).value = 2;
+            }
+            // the old version is still visible to the reader
+            assert(Counted::alive.load() == 2);
+            assert((*old).value == 1);
+        }
+        auto old = lk.read();
+        {
+            auto v = lk.write();
+            (*v).value = 3;
+        }
+        // first version reclaimed, second one still held
+        assert(Counted::alive.load() == 2);
+        assert((*old).value == 2);
+    }
+    {
+        RcuLock<Counted> lk;
+        auto v = lk.write();
+    }
+    // everything retired before the last write was reclaimed by it
+    assert(Counted::alive.load() <= 1);
+    // the last version of the destroyed lock is freed without another write
+    RcuLock<Counted>::synchronize();
+    assert(Counted::alive.load() == 0);
+
+    RcuLock<Counted> lk(std::in_place, 1);
+    {
+        auto old = lk.read();
+        {
+            auto v = lk.write();
+            (*v).value = 2;
+        }
+        RcuLock<Counted>::reclaim();
+        assert(Counted::alive.load() == 2);
+    }
+    RcuLock<Counted>::reclaim();
+    assert(Counted::alive.load() == 1);
+}
+
+void test_concurrent()
+{
+    RcuLock<std::vector<int>> lk(std::in_place, 100, 0);
+    std::atomic<bool> done { false };
+    constexpr int N = 4;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < N; ++i) {
+        readers.push_back(std::thread([&]() {
+            while (done == false) {
+                auto v = lk.read();
+                auto first = (*v).front();
+                for (auto x : *v) {
+                    assert(x == first);
+                }
+            }
+        }));
+    }
+    for (int i = 1; i <= 1000; ++i) {
+        auto v = lk.write();
+        for (auto& x : *v) {
+            x = i;
+        }
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    assert((*lk.read()).back() == 1000);
+}
+
+int main()
+{
+    test_read_write();
+    test_write_exception();
+    test_reclaim();
+    test_concurrent();
+    *static_lock.write() = "written";
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <hsqr/rwlock.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+
+using Lock = RWLock<std::string, RWMutexUnchecked, RWLockAsyncStorage<>>;
+
+// starts running right away and frees its frame when it returns
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+Task write_task(Lock& lk, std::string value, std::string& order)
+{
+    auto v = co_await lk.async_write();
+    *v = value;
+    order += value;
+}
+
+Task read_task(Lock& lk, std::string& seen, std::string& order)
+{
+    auto v = co_await lk.async_read();
+    seen = *v;
+    order += "r";
+}
+
+void test_free_lock()
+{
+    Lock lk(std::in_place, "One");
+    std::string order;
+    std::string seen;
+    // the lock is free, nothing suspends
+    write_task(lk, "Two", order);
+    read_task(lk, seen, order);
+    assert(order == "Twor");
+    assert(seen == "Two");
+    assert(lk.try_write().has_value());
+}
+
+void test_resume_on_release()
+{
+    Lock lk(std::in_place, "One");
+    std::string order;
+    std::string seen1;
+    std::string seen2;
+    {
+        auto w = lk.write();
+        // queued in order, nothing runs while the guard is held
+        write_task(lk, "Two", order);
+        read_task(lk, seen1, order);
+        read_task(lk, seen2, order);
+        assert(order.empty());
+        *w = "Zero";
+    }
+    // the release let the writer in, its release let both readers in
+    assert(order == "Tworr");
+    assert(seen1 == "Two");
+    assert(seen2 == "Two");
+    assert(lk.try_write().has_value());
+}
+
+void test_released_by_another_thread()
+{
+    Lock lk(std::in_place, "One");
+    std::string order;
+    std::string seen;
+    auto w = lk.write();
+    read_task(lk, seen, order);
+    std::thread t([&]() {
+        auto moved = std::move(w);
+        *moved = "Two";
+    });
+    t.join();
+    assert(order == "r");
+    assert(seen == "Two");
+}
+
+struct QueueExecutor {
+    std::vector<std::coroutine_handle<>>* queue;
+    void operator()(std::coroutine_handle<> handle) const
+    {
+        queue->push_back(handle);
+    }
+};
+
+Task executor_task(Lock& lk, QueueExecutor executor, bool& done)
+{
+    auto v = co_await lk.async_write(executor);
+    *v = "Two";
+    done = true;
+}
+
+void test_executor()
+{
+    Lock lk(std::in_place, "One");
+    std::vector<std::coroutine_handle<>> queue;
+    bool done = false;
+    {
+        auto r = lk.read();
+        executor_task(lk, QueueExecutor { &queue }, done);
+    }
+    // the lock was taken for the coroutine, it runs when the executor does
+    assert(queue.size() == 1);
+    assert(done == false);
+    assert(lk.try_read().has_value() == false);
+    queue.front().resume();
+    assert(done == true);
+    assert(*lk.read() == "Two");
+}
+
+// a blocking reader that comes while a coroutine writer is queued lines up
+// behind it, even though the lock is only read locked
+void test_blocking_reader_waits_in_line()
+{
+    Lock lk(std::in_place, "One");
+    std::string order;
+    std::atomic<bool> done { false };
+    std::string seen;
+    std::thread reader;
+    {
+        auto r = lk.read();
+        write_task(lk, "Two", order);
+        reader = std::thread([&]() {
+            seen = *lk.read();
+            done = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        assert(done == false);
+        assert(order.empty());
+    }
+    reader.join();
+    assert(order == "Two");
+    assert(seen == "Two");
+}
+
+// the thread granting the lock to a coroutine writer does not wait for the
+// frozen readers, the last of them to leave lets the writer in
+void test_frozen_writer()
+{
+    Lock lk(std::in_place, "One");
+    lk.freeze();
+    std::string order;
+    {
+        auto r = lk.read();
+        write_task(lk, "Two", order);
+        assert(order.empty());
+        assert(lk.frozen());
+    }
+    assert(order == "Two");
+    assert(lk.frozen() == false);
+    assert(*lk.read() == "Two");
+}
+
+// a coroutine reader that comes while a coroutine writer is queued lines up
+// behind it, even though the lock is only read locked
+void test_async_reader_waits_in_line()
+{
+    Lock lk(std::in_place, "One");
+    std::string order;
+    std::string seen1;
+    std::string seen2;
+    {
+        auto r = lk.read();
+        write_task(lk, "W", order);
+        read_task(lk, seen1, order);
+        read_task(lk, seen2, order);
+        assert(order.empty());
+    }
+    assert(order == "Wrr");
+    assert(seen1 == "W");
+    assert(seen2 == "W");
+}
+
+void test_size()
+{
+    // the locks without the coroutine API do not carry the queue
+    static_assert(sizeof(RWLock<int, RWMutexUnchecked>)
+        < sizeof(RWLock<int, RWMutexUnchecked, RWLockAsyncStorage<>>));
+    static_assert(!detail::has_thread_detector<RWMutexUnchecked>::value);
+    static_assert(detail::has_thread_detector<RWMutexChecked>::value);
+}
+
+int main()
+{
+    test_free_lock();
+    test_resume_on_release();
+    test_released_by_another_thread();
+    test_executor();
+    test_blocking_reader_waits_in_line();
+    test_async_reader_waits_in_line();
+    test_frozen_writer();
+    test_size();
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -161,10 +162,312 @@ void test_multi_write()
     test_thread.join();
 }
 
+void test_move()
+{
+    RWLock<std::string> lk(std::in_place, "One");
+    RWLock<std::string> lk2(std::move(lk));
+    assert(*lk2.read() == "One");
+    {
+        auto v = lk.write();
+        *v = "Two";
+    }
+    lk2 = std::move(lk);
+    assert(*lk2.read() == "Two");
+
+    auto g1 = lk2.write();
+    auto g2 = std::move(g1);
+    *g2 = "Three";
+    g1 = std::move(g2);
+    assert(*g1 == "Three");
+
+    // assigning a new guard releases the lock of the old one. the second
+    // lock is taken while the first is held, the checked detector would
+    // report the nesting
+    RWLock<std::string, RWMutexUnchecked> a(std::in_place, "A");
+    RWLock<std::string, RWMutexUnchecked> b(std::in_place, "B");
+    auto g3 = a.write();
+    g3 = b.write();
+    *g3 = "Four";
+    assert(*g3 == "Four");
+    assert(a.try_write().has_value());
+    assert(b.try_read().has_value() == false);
+}
+
+void test_shared_storage()
+{
+    auto lk = std::make_unique<RWLock<std::string, RWMutex, RWLockSharedStorage>>(
+        std::in_place, "One");
+    auto v = lk->read();
+    // the guard keeps the state alive
+    lk.reset();
+    assert(*v == "One");
+}
+
+void test_load()
+{
+    struct Pair {
+        int first;
+        int second;
+    };
+    RWLock<Pair> lk(std::in_place, Pair { 0, 0 });
+    std::atomic<bool> done { false };
+
+    std::thread writer([&]() {
+        for (int i = 1; i <= 10000; ++i) {
+            auto v = lk.write();
+            (*v).first = i;
+            (*v).second = i;
+        }
+        done = true;
+    });
+
+    while (done == false) {
+        auto p = lk.load();
+        assert(p.first == p.second);
+        auto sum = lk.read_optimistic([](const Pair& p) { return p.first + p.second; });
+        assert(sum % 2 == 0);
+    }
+    writer.join();
+    assert(lk.load().first == 10000);
+}
+
+void test_try()
+{
+    // the same thread tries the write lock while it reads
+    RWLock<std::string, RWMutexUnchecked> lk(std::in_place, "One");
+    {
+        auto r = lk.try_read();
+        assert(r.has_value());
+        assert(**r == "One");
+        assert(lk.try_write().has_value() == false);
+        assert(lk.try_write_for(std::chrono::milliseconds(1)).has_value() == false);
+    }
+    {
+        auto w = lk.try_write();
+        assert(w.has_value());
+        **w = "Two";
+        assert(lk.try_read().has_value() == false);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+        assert(lk.try_read_until(deadline).has_value() == false);
+    }
+    assert(**lk.try_read_for(std::chrono::milliseconds(1)) == "Two");
+}
+
+void test_upgradable()
+{
+    RWLock<std::string, RWMutexUnchecked> lk(std::in_place, "One");
+    auto u = lk.upgradable_read();
+    assert(*u == "One");
+    assert(*lk.read() == "One");
+    auto w = std::move(u).upgrade();
+    *w = "Two";
+    auto r = std::move(w).downgrade();
+    assert(*r == "Two");
+    assert(*lk.read() == "Two");
+    assert(lk.try_write().has_value() == false);
+}
+
+void test_write_combined()
+{
+    RWLock<int, RWMutexUnchecked> lk(std::in_place, 0);
+    constexpr int N = 8;
+    constexpr int K = 10000;
+    std::vector<std::vector<int>> seen(N);
+    std::vector<std::thread> v;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread([&, i]() {
+            for (int k = 0; k < K; ++k) {
+                seen[i].push_back(lk.write_combined([](int& value) { return ++value; }));
+                if (k % 100 == 0) {
+                    assert(*lk.read() >= seen[i].back());
+                }
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(*lk.read() == N * K);
+    // every call saw its own increment
+    std::vector<bool> found(N * K + 1, false);
+    for (auto& s : seen) {
+        for (auto value : s) {
+            assert(found[value] == false);
+            found[value] = true;
+        }
+    }
+
+    lk.write_combined([](int& value) { value = -1; });
+    assert(lk.load() == -1);
+    bool thrown = false;
+    try {
+        lk.write_combined([](int&) -> int { throw std::runtime_error("fail"); });
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(lk.try_write().has_value());
+}
+
+void test_version()
+{
+    RWLock<std::string> lk(std::in_place, "One");
+    auto version = lk.version();
+    assert(version == 0);
+    {
+        auto r = lk.read();
+    }
+    assert(lk.version() == version);
+    {
+        auto v = lk.write();
+        *v = "Two";
+        assert(lk.version() == version);
+    }
+    assert(lk.version() == version + 1);
+    version = lk.version();
+
+    // nothing changes, the wait times out
+    auto start = std::chrono::steady_clock::now();
+    assert(lk.wait_for_change(version, std::chrono::milliseconds(20)) == version);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    // a version older than the current one returns right away
+    assert(lk.wait_for_change(version - 1) == version);
+
+    std::thread waiter([&]() {
+        auto seen = lk.wait_for_change(version);
+        assert(seen > version);
+        assert(*lk.read() == "Three");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    *lk.write() = "Three";
+    waiter.join();
+    assert(lk.version() == version + 1);
+}
+
+void test_freeze()
+{
+    struct Pair {
+        int first;
+        int second;
+    };
+    RWLock<Pair, RWMutexUnchecked> lk(std::in_place, Pair { 0, 0 });
+    lk.freeze();
+    assert(lk.frozen());
+    {
+        // several frozen reads at once, without the mutex
+        auto r1 = lk.read();
+        auto r2 = lk.read();
+        assert((*r1).first == 0 && (*r2).second == 0);
+    }
+
+    // a write waits for the frozen reader to leave
+    std::atomic<bool> reading { false };
+    std::atomic<bool> released { false };
+    std::thread reader([&]() {
+        auto r = lk.read();
+        reading = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        released = true;
+    });
+    while (reading == false) {
+        std::this_thread::yield();
+    }
+    {
+        auto w = lk.write();
+        assert(released == true);
+        assert(lk.frozen() == false);
+        (*w).first = 1;
+        (*w).second = 1;
+    }
+    reader.join();
+    assert(lk.version() == 1);
+    assert(lk.try_write().has_value());
+
+    // the try writes do not wait for the frozen readers past the deadline,
+    // the lock stays frozen
+    lk.freeze();
+    {
+        auto r = lk.read();
+        assert(lk.try_write().has_value() == false);
+        auto start = std::chrono::steady_clock::now();
+        assert(lk.try_write_for(std::chrono::milliseconds(10)).has_value() == false);
+        assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(10));
+        assert(lk.frozen());
+    }
+    reading = false;
+    reader = std::thread([&]() {
+        auto r = lk.read();
+        reading = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    });
+    while (reading == false) {
+        std::this_thread::yield();
+    }
+    assert(lk.try_write_for(std::chrono::seconds(10)).has_value());
+    assert(lk.frozen() == false);
+    reader.join();
+
+    lk.freeze();
+    lk.thaw();
+    assert(lk.frozen() == false);
+    lk.thaw();
+
+    // readers never see a half written value across freezes and thaws
+    std::atomic<bool> done { false };
+    std::vector<std::thread> v;
+    for (int i = 0; i < 4; ++i) {
+        v.push_back(std::thread([&]() {
+            while (done == false) {
+                auto r = lk.read();
+                assert((*r).first == (*r).second);
+            }
+        }));
+    }
+    for (int i = 2; i <= 200; ++i) {
+        {
+            auto w = lk.write();
+            (*w).first = i;
+            (*w).second = i;
+        }
+        if (i % 2 == 0) {
+            lk.freeze();
+        }
+    }
+    done = true;
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(lk.frozen());
+    assert((*lk.read()).first == 200);
+
+    // a thaw only waits for the frozen readers of its own lock
+    RWLock<int, RWMutexUnchecked> other(std::in_place, 0);
+    other.freeze();
+    {
+        auto r = other.read();
+        lk.thaw();
+        assert(lk.frozen() == false);
+        assert(other.frozen());
+    }
+    // a frozen read guard released on another thread
+    auto r = other.read();
+    std::thread([g = std::move(r)]() {}).join();
+    other.thaw();
+    assert(other.frozen() == false);
+}
+
 int main()
 {
     test_multi_read();
     test_multi_read_one_write();
     test_multi_write();
+    test_move();
+    test_shared_storage();
+    test_load();
+    test_try();
+    test_upgradable();
+    test_write_combined();
+    test_version();
+    test_freeze();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include <cassert>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-cohort.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+using namespace hsqr::test;
+
+struct hsqr::test::RWMutexCohortDiag {
+    template <typename M>
+    static int GetReadCount(M& mu)
+    {
+        int count = 0;
+        for (auto& node : mu.m_nodes) {
+            count += node.readers.load();
+        }
+        return count;
+    }
+    template <typename M>
+    static bool IsLocked(M& mu)
+    {
+        return mu.m_global.load() != M::Free;
+    }
+    // consecutive handoffs on the node, only stable under the write lock
+    template <typename M>
+    static uint32_t GetHandoffs(M& mu, std::size_t node)
+    {
+        return mu.m_nodes[node].handoffs;
+    }
+};
+
+// run fn on a thread that pretends to run on the given node
+template <typename F>
+std::thread on_node(std::size_t node, F fn)
+{
+    return std::thread([node, fn]() {
+        detail::thread_numa_node() = node;
+        fn();
+    });
+}
+
+void test_exclusion()
+{
+    RWMutexCohort m;
+    int value = 0;
+    std::atomic<int> readers { 0 };
+    std::vector<std::thread> v;
+    for (int t = 0; t < 8; ++t) {
+        v.push_back(on_node(t % 3, [&, t]() {
+            for (int i = 0; i < 20000; ++i) {
+                if ((i + t) % 4 == 0) {
+                    m.write_lock();
+                    assert(readers.load() == 0);
+                    ++value;
+                    m.write_unlock();
+                } else {
+                    m.read_lock();
+                    ++readers;
+                    --readers;
+                    m.read_unlock();
+                }
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(value == 8 * 5000);
+    assert(RWMutexCohortDiag::GetReadCount(m) == 0);
+    assert(RWMutexCohortDiag::IsLocked(m) == false);
+}
+
+// the owner runs on node 0, a writer of node 1 queues first, then a writer
+// of node 0. returns the order in which they got the lock, and the handoffs
+// of node 0 seen by its writer
+template <typename M>
+std::string handoff_order(uint32_t& localHandoffs)
+{
+    M m;
+    constexpr int wait_time = 20;
+    std::mutex order_mutex;
+    std::string order;
+    auto writer = [&](char c) {
+        return [&, c]() {
+            m.write_lock();
+            {
+                std::lock_guard<std::mutex> lock(order_mutex);
+                order += c;
+            }
+            if (c == 'L') {
+                localHandoffs = RWMutexCohortDiag::GetHandoffs(m, 0);
+            }
+            m.write_unlock();
+        };
+    };
+
+    detail::thread_numa_node() = 0;
+    m.write_lock();
+    auto remote = on_node(1, writer('R'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    auto local = on_node(0, writer('L'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    m.write_unlock();
+    remote.join();
+    local.join();
+    return order;
+}
+
+void test_handoff()
+{
+    // the global lock is passed to the local writer, before the remote one
+    uint32_t handoffs = 0;
+    assert((handoff_order<RWMutexCohortUnchecked>(handoffs) == "LR"));
+    assert(handoffs == 1);
+    // without handoffs the global lock is released, the local and the remote
+    // writer then race for it
+    auto order = handoff_order<RWMutexCohortImpl<RWMutexNullDeadLockDetector, 8, 0>>(
+        handoffs);
+    assert(order == "LR" || order == "RL");
+    assert(handoffs == 0);
+}
+
+void test_readers_wait_for_writer()
+{
+    RWMutexCohort m;
+    m.write_lock();
+    std::atomic<bool> done { false };
+    auto reader = on_node(1, [&]() {
+        m.read_lock();
+        done = true;
+        m.read_unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(done == false);
+    m.write_unlock();
+    reader.join();
+    assert(done == true);
+}
+
+void test_rwlock()
+{
+    RWLock<std::string, RWMutexCohort> lk(std::in_place, "One");
+    {
+        auto v = lk.write();
+        *v = "Two";
+    }
+    assert(*lk.read() == "Two");
+}
+
+int main()
+{
+    test_exclusion();
+    test_handoff();
+    test_readers_wait_for_writer();
+    test_rwlock();
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <cassert>
+#include <cstdint>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-compact.h>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+using namespace hsqr::test;
+
+struct hsqr::test::RWMutexCompactDiag {
+    template <typename M>
+    static uint32_t GetState(M& mu)
+    {
+        return mu.m_state.load();
+    }
+};
+
+using Entry = RWLock<uint32_t, RWMutexCompactUnchecked, RWLockCompactStorage>;
+
+void test_size()
+{
+    static_assert(sizeof(RWMutexCompactUnchecked) == 4);
+    static_assert(sizeof(Entry) == 8);
+    static_assert(sizeof(RWLock<uint64_t, RWMutexCompactUnchecked,
+                      RWLockCompactStorage>)
+        == 16);
+}
+
+void test_exclusion()
+{
+    RWMutexCompact m;
+    int value = 0;
+    std::atomic<int> readers { 0 };
+    std::vector<std::thread> v;
+    for (int t = 0; t < 8; ++t) {
+        v.push_back(std::thread([&, t]() {
+            for (int i = 0; i < 20000; ++i) {
+                if ((i + t) % 4 == 0) {
+                    m.write_lock();
+                    assert(readers.load() == 0);
+                    ++value;
+                    m.write_unlock();
+                } else {
+                    m.read_lock();
+                    ++readers;
+                    --readers;
+                    m.read_unlock();
+                }
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(value == 8 * 5000);
+    assert(RWMutexCompactDiag::GetState(m) == 0);
+}
+
+void test_timed_and_downgrade()
+{
+    RWMutexCompactUnchecked m;
+    m.read_lock();
+    assert(m.try_read_lock());
+    assert(m.try_write_lock() == false);
+    // the writer gives up its claim, the readers are let in again
+    std::thread w([&]() {
+        assert(m.try_write_lock_for(std::chrono::milliseconds(10)) == false);
+    });
+    w.join();
+    assert(m.try_read_lock());
+    m.read_unlock();
+    m.read_unlock();
+    m.read_unlock();
+
+    m.write_lock();
+    std::thread r([&]() {
+        m.read_lock();
+        m.read_unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    m.downgrade();
+    r.join();
+    assert(m.try_write_lock() == false);
+    m.read_unlock();
+    assert(RWMutexCompactDiag::GetState(m) == 0);
+}
+
+void test_table()
+{
+    std::vector<Entry> table(1000);
+    std::vector<std::thread> v;
+    for (int t = 0; t < 4; ++t) {
+        v.push_back(std::thread([&]() {
+            for (int i = 0; i < 10000; ++i) {
+                auto& entry = table[i % table.size()];
+                if (i % 2 == 0) {
+                    *entry.write() += 1;
+                } else {
+                    entry.write_combined([](uint32_t& value) { value += 1; });
+                }
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    for (auto& entry : table) {
+        assert(*entry.read() == 40);
+        assert(entry.load() == 40);
+    }
+}
+
+int main()
+{
+    test_size();
+    test_exclusion();
+    test_timed_and_downgrade();
+    test_table();
+    return 0;
+}
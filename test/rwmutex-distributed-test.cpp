@@ -0,0 +1,179 @@
+#include <cassert>
+#include <functional>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-distributed.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace hsqr;
+using namespace hsqr::test;
+
+struct hsqr::test::RWMutexDistributedDiag {
+    template <typename M>
+    static int GetReadCount(M& mu)
+    {
+        int count = 0;
+        for (auto& slot : mu.m_slots) {
+            count += slot.readers.load();
+        }
+        return count;
+    }
+    template <typename M>
+    static bool IsLocked(M& mu)
+    {
+        return mu.m_writer.load() != M::WriterNone;
+    }
+};
+
+void test_multi_read()
+{
+    RWMutexDistributed m;
+    bool unlock_t1 = false;
+    std::atomic<int> counter { 0 };
+
+    auto f = [&]() {
+        m.read_lock();
+        ++counter;
+        while (unlock_t1 == false) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        m.read_unlock();
+    };
+
+    constexpr int N = 10;
+    std::vector<std::thread> v;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread { f });
+    }
+
+    constexpr int wait_time = 100;
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(counter.load() == N);
+    assert(RWMutexDistributedDiag::GetReadCount(m) == N);
+    assert(RWMutexDistributedDiag::IsLocked(m) == false);
+    unlock_t1 = true;
+
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(RWMutexDistributedDiag::GetReadCount(m) == 0);
+}
+
+void test_multi_read_one_write()
+{
+    RWMutexDistributed m;
+    constexpr int N = 4;
+    std::atomic<bool> unlock_readers { false };
+    std::atomic<bool> unlock_writer { false };
+    std::atomic<int> active_readers { 0 };
+    std::atomic<bool> writer_active { false };
+
+    auto f_read = [&]() {
+        m.read_lock();
+        assert(writer_active.load() == false);
+        ++active_readers;
+        while (unlock_readers.load() == false) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        --active_readers;
+        m.read_unlock();
+    };
+    auto f_write = [&]() {
+        m.write_lock();
+        writer_active.store(true);
+        assert(active_readers.load() == 0);
+        while (unlock_writer.load() == false) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        writer_active.store(false);
+        m.write_unlock();
+    };
+
+    constexpr int wait_time = 20;
+    std::vector<std::thread> v;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread { f_read });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    std::thread w(f_write);
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    // the writer flag is set but the readers still hold the lock
+    assert(RWMutexDistributedDiag::IsLocked(m) == true);
+    assert(writer_active.load() == false);
+    assert(active_readers.load() == N);
+
+    unlock_readers = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(writer_active.load() == true);
+
+    // readers coming in now wait for the writer
+    unlock_readers = false;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread { f_read });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(active_readers.load() == 0);
+    unlock_writer = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(active_readers.load() == N);
+    unlock_readers = true;
+
+    for (auto& t : v) {
+        t.join();
+    }
+    w.join();
+    assert(RWMutexDistributedDiag::GetReadCount(m) == 0);
+    assert(RWMutexDistributedDiag::IsLocked(m) == false);
+}
+
+void test_rwlock()
+{
+    RWLock<std::string, RWMutexDistributed> lk(std::in_place, "One");
+    {
+        auto v = lk.read();
+        assert(*v == "One");
+    }
+    {
+        auto v = lk.write();
+        *v = "Two";
+    }
+    assert(*lk.read() == "Two");
+}
+
+void test_dead_lock_detector()
+{
+    {
+        RWMutexDistributedChecked m;
+        bool good = false;
+        m.read_lock();
+        try {
+            m.write_lock();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        m.read_unlock();
+    }
+    {
+        RWMutexDistributedChecked m;
+        bool good = false;
+        m.write_lock();
+        try {
+            m.read_lock();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        m.write_unlock();
+    }
+}
+
+int main()
+{
+    test_multi_read();
+    test_multi_read_one_write();
+    test_rwlock();
+    test_dead_lock_detector();
+    return 0;
+}
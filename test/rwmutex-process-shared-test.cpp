@@ -0,0 +1,145 @@
+#include <cassert>
+#include <cstdint>
+#include <hsqr/rwmutex-process-shared.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace hsqr;
+
+struct Shared {
+    RWMutexProcessShared m;
+    int64_t value = 0;
+    int64_t copy = 0;
+    std::atomic<int> ready { 0 };
+};
+
+Shared* map_shared()
+{
+    void* p = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(p != MAP_FAILED);
+    return new (p) Shared();
+}
+
+void unmap_shared(Shared* s)
+{
+    s->~Shared();
+    munmap(s, sizeof(Shared));
+}
+
+template <typename F>
+pid_t spawn(F fn)
+{
+    auto pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        fn();
+        _exit(0);
+    }
+    return pid;
+}
+
+void join(pid_t pid)
+{
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_exclusion()
+{
+    auto s = map_shared();
+    constexpr int P = 4;
+    constexpr int N = 2000;
+    pid_t children[P];
+    for (int p = 0; p < P; ++p) {
+        children[p] = spawn([s, p]() {
+            for (int i = 0; i < N; ++i) {
+                if ((i + p) % 4 == 0) {
+                    s->m.write_lock();
+                    ++s->value;
+                    s->copy = s->value;
+                    s->m.write_unlock();
+                } else {
+                    s->m.read_lock();
+                    if (s->copy != s->value) {
+                        _exit(1);
+                    }
+                    s->m.read_unlock();
+                }
+            }
+        });
+    }
+    for (auto pid : children) {
+        join(pid);
+    }
+    assert(s->value == P * N / 4);
+    assert(s->m.owner_died() == false);
+    unmap_shared(s);
+}
+
+void test_try_lock()
+{
+    auto s = map_shared();
+    assert(s->m.try_read_lock());
+    // the child sees the read lock of the parent
+    join(spawn([s]() {
+        if (s->m.try_write_lock() || !s->m.try_read_lock()) {
+            _exit(1);
+        }
+        s->m.read_unlock();
+    }));
+    s->m.read_unlock();
+    assert(s->m.try_write_lock());
+    assert(s->m.try_read_lock() == false);
+    s->m.write_unlock();
+    unmap_shared(s);
+}
+
+void test_writer_died()
+{
+    auto s = map_shared();
+    auto pid = spawn([s]() {
+        s->m.write_lock();
+        s->value = 1;
+        s->ready = 1;
+        // dies holding the lock
+    });
+    while (s->ready.load() == 0) {
+        usleep(1000);
+    }
+    // the child is not reaped yet, it is a zombie
+    s->m.write_lock();
+    assert(s->m.owner_died());
+    assert(s->value == 1);
+    s->m.mark_consistent();
+    s->m.write_unlock();
+    assert(s->m.owner_died() == false);
+    s->m.read_lock();
+    s->m.read_unlock();
+    join(pid);
+    unmap_shared(s);
+}
+
+void test_reader_died()
+{
+    auto s = map_shared();
+    join(spawn([s]() {
+        s->m.read_lock();
+    }));
+    s->m.write_lock();
+    assert(s->m.owner_died() == false);
+    s->m.write_unlock();
+    unmap_shared(s);
+}
+
+int main()
+{
+    test_exclusion();
+    test_try_lock();
+    test_writer_died();
+    test_reader_died();
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cassert>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-queue.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+using namespace hsqr::test;
+
+struct hsqr::test::RWMutexQueueDiag {
+    template <typename M>
+    static bool IsIdle(M& mu)
+    {
+        return (mu.m_state.load() & ~M::HeadParked) == 0
+            && mu.m_tail.load() == nullptr;
+    }
+};
+
+void test_exclusion()
+{
+    RWMutexQueue m;
+    int value = 0;
+    std::atomic<int> readers { 0 };
+    std::vector<std::thread> v;
+    for (int t = 0; t < 8; ++t) {
+        v.push_back(std::thread([&, t]() {
+            for (int i = 0; i < 20000; ++i) {
+                if ((i + t) % 4 == 0) {
+                    m.write_lock();
+                    assert(readers.load() == 0);
+                    ++value;
+                    m.write_unlock();
+                } else {
+                    m.read_lock();
+                    ++readers;
+                    --readers;
+                    m.read_unlock();
+                }
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(value == 8 * 5000);
+    assert(RWMutexQueueDiag::IsIdle(m));
+}
+
+// a writer holds the lock while two readers, a writer and a reader queue up.
+// the two readers get in together, then the writer, then the last reader
+void test_fifo()
+{
+    RWMutexQueueUnchecked m;
+    constexpr int wait_time = 20;
+    std::mutex order_mutex;
+    std::string order;
+    std::atomic<int> readers { 0 };
+    int max_readers = 0;
+    auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order += c;
+        max_readers = std::max(max_readers, readers.load());
+    };
+    auto reader = [&](char c) {
+        return std::thread([&, c]() {
+            m.read_lock();
+            ++readers;
+            record(c);
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+            --readers;
+            m.read_unlock();
+        });
+    };
+
+    m.write_lock();
+    std::vector<std::thread> v;
+    v.push_back(reader('A'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(reader('B'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(std::thread([&]() {
+        m.write_lock();
+        assert(readers.load() == 0);
+        record('W');
+        m.write_unlock();
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(reader('C'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    // nobody bypasses the queue
+    assert(m.try_read_lock() == false);
+    assert(m.try_write_lock() == false);
+    m.write_unlock();
+    for (auto& t : v) {
+        t.join();
+    }
+    assert(order == "ABWC");
+    assert(max_readers == 2);
+    assert(RWMutexQueueDiag::IsIdle(m));
+}
+
+void test_other_thread_unlock()
+{
+    RWMutexQueueUnchecked m;
+    std::thread([&]() { m.read_lock(); }).join();
+    assert(m.try_write_lock() == false);
+    m.read_unlock();
+    std::thread([&]() { m.write_lock(); }).join();
+    assert(m.try_read_lock() == false);
+    m.downgrade();
+    assert(m.try_read_lock());
+    m.read_unlock();
+    m.read_unlock();
+    assert(RWMutexQueueDiag::IsIdle(m));
+}
+
+void test_rwlock()
+{
+    RWLock<std::string, RWMutexQueue> lk(std::in_place, "One");
+    {
+        auto v = lk.write();
+        *v = "Two";
+    }
+    assert(*lk.read() == "Two");
+}
+
+int main()
+{
+    test_exclusion();
+    test_fifo();
+    test_other_thread_unlock();
+    test_rwlock();
+    return 0;
+}
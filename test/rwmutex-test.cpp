@@ -2,6 +2,8 @@
 #include <functional>
 #include <hsqr/rwmutex.h>
 #include <iostream>
+#include <mutex>
+#include <string>
 #include <vector>
 
 using namespace hsqr;
@@ -16,21 +18,29 @@ struct hsqr::test::RWMutexDiag {
     template <typename M>
     static int GetReadCount(M& mu)
     {
-        return mu.m_counter.load().reads;
+        return int(mu.m_state.load() & M::ReaderMask);
     }
     template <typename M>
     static WriteState GetWriteState(M& mu)
     {
-        return WriteState(mu.m_counter.load().write);
+        auto state = mu.m_state.load();
+        if (state & M::WriteOwned) {
+            return WriteOwned;
+        }
+        if (state & M::WriteWaiting) {
+            return WriteWaiting;
+        }
+        return WriteNone;
+    }
+    template <typename M>
+    static bool IsUpgradable(M& mu)
+    {
+        return (mu.m_state.load() & M::Upgradable) != 0;
     }
     template <typename M>
     static int IsLocked(M& mu)
     {
-        if (mu.m_mutex.try_lock()) {
-            mu.m_mutex.unlock();
-            return false;
-        }
-        return true;
+        return (mu.m_state.load() & (M::WriteWaiting | M::WriteOwned)) != 0;
     }
 };
 
@@ -203,12 +213,341 @@ void test_multi_read_one_write()
     test_thread.join();
 }
 
+void test_many_readers()
+{
+    // more readers than the old 16 bit counter could hold
+    RWMutexUnchecked m;
+    constexpr int N = 70000;
+    for (int i = 0; i < N; ++i) {
+        m.read_lock();
+    }
+    assert(RWMutexDiag::GetReadCount(m) == N);
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteNone);
+    for (int i = 0; i < N; ++i) {
+        m.read_unlock();
+    }
+    assert(RWMutexDiag::GetReadCount(m) == 0);
+    m.write_lock();
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteOwned);
+    m.write_unlock();
+}
+
+void test_try_lock()
+{
+    // the same thread tries the write lock while it reads
+    RWMutexUnchecked m;
+    m.read_lock();
+    assert(m.try_read_lock() == true);
+    assert(m.try_write_lock() == false);
+    m.read_unlock();
+    m.read_unlock();
+    assert(m.try_write_lock() == true);
+    assert(m.try_read_lock() == false);
+    assert(m.try_write_lock() == false);
+    m.write_unlock();
+    assert(RWMutexDiag::GetReadCount(m) == 0);
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteNone);
+}
+
+void test_timed_lock()
+{
+    RWMutex m;
+    constexpr auto wait_time = std::chrono::milliseconds(20);
+
+    // a writer blocks timed readers and writers
+    m.write_lock();
+    std::thread t([&]() {
+        auto start = std::chrono::steady_clock::now();
+        assert(m.try_read_lock_for(wait_time) == false);
+        assert(m.try_write_lock_until(std::chrono::system_clock::now() + wait_time) == false);
+        assert(std::chrono::steady_clock::now() - start >= 2 * wait_time);
+    });
+    t.join();
+    m.write_unlock();
+
+    // a timed writer gives up waiting for a reader and lets the readers
+    // queued behind it in
+    m.read_lock();
+    std::atomic<bool> reader_done { false };
+    std::thread w([&]() {
+        assert(m.try_write_lock_for(5 * wait_time) == false);
+    });
+    std::this_thread::sleep_for(wait_time);
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteWaiting);
+    std::thread r([&]() {
+        m.read_lock();
+        reader_done = true;
+        m.read_unlock();
+    });
+    std::this_thread::sleep_for(wait_time);
+    assert(reader_done == false);
+    w.join();
+    r.join();
+    assert(reader_done == true);
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteNone);
+    m.read_unlock();
+
+    // a timed reader gets the lock once the writer leaves
+    m.write_lock();
+    std::thread r2([&]() {
+        assert(m.try_read_lock_for(std::chrono::seconds(10)) == true);
+        m.read_unlock();
+    });
+    std::this_thread::sleep_for(wait_time);
+    m.write_unlock();
+    r2.join();
+}
+
+void test_upgradable()
+{
+    // the read lock is released by another thread
+    RWMutexUnchecked m;
+    constexpr int wait_time = 20;
+    std::atomic<bool> writer_done { false };
+    std::atomic<bool> upgradable_done { false };
+
+    // readers and the upgradable holder share the lock
+    m.upgradable_lock();
+    m.read_lock();
+    assert(RWMutexDiag::GetReadCount(m) == 2);
+    assert(RWMutexDiag::IsUpgradable(m) == true);
+    assert(m.try_write_lock() == false);
+
+    // a writer and a second upgradable wait for the upgradable holder
+    std::thread w([&]() {
+        m.write_lock();
+        writer_done = true;
+        m.write_unlock();
+    });
+    std::thread u([&]() {
+        m.upgradable_lock();
+        upgradable_done = true;
+        m.upgradable_unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(writer_done == false);
+    assert(upgradable_done == false);
+
+    // the upgrade waits for the reader to leave
+    std::thread r([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+        assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteWaiting);
+        m.read_unlock();
+    });
+    m.upgrade();
+    r.join();
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteOwned);
+    assert(RWMutexDiag::IsUpgradable(m) == false);
+    assert(writer_done == false);
+
+    // after the downgrade the writer still waits for the read lock
+    m.downgrade();
+    assert(RWMutexDiag::GetReadCount(m) >= 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    assert(writer_done == false);
+    m.read_unlock();
+
+    w.join();
+    u.join();
+    assert(writer_done == true);
+    assert(upgradable_done == true);
+    assert(RWMutexDiag::GetReadCount(m) == 0);
+    assert(RWMutexDiag::GetWriteState(m) == RWMutexDiag::WriteNone);
+}
+
+// one reader holds the lock, a writer waits for it, then a reader and a
+// second writer queue up. returns the order in which the queued threads and
+// a reader arriving last got the lock
+template <typename Fairness>
+std::string fairness_order()
+{
+    RWMutexImpl<RWMutexNullDeadLockDetector, Fairness> m;
+    constexpr int wait_time = 20;
+    std::mutex order_mutex;
+    std::string order;
+    auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order += c;
+    };
+    auto reader = [&](char c) {
+        m.read_lock();
+        record(c);
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+        m.read_unlock();
+    };
+    auto writer = [&](char c) {
+        m.write_lock();
+        record(c);
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+        m.write_unlock();
+    };
+
+    m.read_lock();
+    std::vector<std::thread> v;
+    v.push_back(std::thread(writer, 'W'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(std::thread(reader, 'r'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(std::thread(writer, 'X'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    m.read_unlock();
+    for (auto& t : v) {
+        t.join();
+    }
+    return order;
+}
+
+void test_fairness()
+{
+    // the reader does not wait for the waiting writers
+    assert(fairness_order<RWMutexReaderPreferring>()[0] == 'r');
+    // the writers go first
+    assert(fairness_order<RWMutexWriterPreferring>() == "WXr");
+    // the reader queued behind W gets in before X
+    assert(fairness_order<RWMutexPhaseFair>() == "WrX");
+    assert(fairness_order<RWMutexPriorityHandoff>() == "WXr");
+}
+
+void test_priority_handoff()
+{
+    RWMutexImpl<RWMutexNullDeadLockDetector, RWMutexPriorityHandoff,
+        RWMutexNullStats, RWMutexNoBackoff>
+        m;
+    constexpr int wait_time = 20;
+    std::mutex order_mutex;
+    std::string order;
+    auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order += c;
+    };
+    auto writer = [&](char c, int priority) {
+        return std::thread([&, c, priority]() {
+            RWMutexPriority scope(priority);
+            m.write_lock();
+            record(c);
+            m.write_unlock();
+        });
+    };
+
+    // two batch writers and a reader queue up, then an urgent writer
+    m.write_lock();
+    std::vector<std::thread> v;
+    v.push_back(writer('L', 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(std::thread([&]() {
+        m.read_lock();
+        record('r');
+        m.read_unlock();
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(writer('M', 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    v.push_back(writer('H', 10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    // a writer with a deadline gives up its place in the queue
+    {
+        RWMutexPriority scope(20);
+        assert(m.try_write_lock_for(std::chrono::milliseconds(wait_time)) == false);
+    }
+    assert(order.empty());
+    m.write_unlock();
+    for (auto& t : v) {
+        t.join();
+    }
+    // the urgent writer first, the others in arrival order, the reader last
+    assert(order == "HLMr");
+    assert(RWMutexDiag::IsLocked(m) == false);
+}
+
+void test_stats()
+{
+    RWMutexImpl<RWMutexNullDeadLockDetector, RWMutexWriterPreferring,
+        RWMutexStats>
+        m;
+    m.read_lock();
+    m.read_lock();
+    m.read_unlock();
+    m.read_unlock();
+
+    // the writer has to wait for the reader
+    m.read_lock();
+    std::thread w([&]() {
+        m.write_lock();
+        m.write_unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    m.read_unlock();
+    w.join();
+
+    auto stats = m.stats();
+    assert(stats.readAcquisitions == 3);
+    assert(stats.readContended == 0);
+    assert(stats.writeAcquisitions == 1);
+    assert(stats.writeContended == 1);
+    assert(stats.maxReaders == 2);
+    uint64_t holds = 0;
+    for (auto count : stats.readHold) {
+        holds += count;
+    }
+    assert(holds == 3);
+    // the write wait was at least 1ms, bucket 21 starts at 2^20 ns
+    uint64_t long_waits = 0;
+    for (size_t i = 21; i < stats.writeWait.size(); ++i) {
+        long_waits += stats.writeWait[i];
+    }
+    assert(long_waits == 1);
+}
+
+void test_backoff()
+{
+    RWMutexAdaptiveBackoffImpl<16, 4096, 64> backoff;
+    auto initial = backoff.budget();
+    assert(initial == 256);
+
+    // the lock was never free while the thread spun, spinning was wasted
+    auto spinner = backoff.start();
+    while (backoff.spin(spinner)) {
+    }
+    assert(spinner.spun >= initial);
+    backoff.acquired(spinner);
+    assert(backoff.budget() < initial);
+
+    // the lock was taken late in the budget, spin longer next time
+    auto budget = backoff.budget();
+    spinner = backoff.start();
+    while (spinner.spun < budget - 8 && backoff.spin(spinner)) {
+    }
+    backoff.acquired(spinner);
+    assert(backoff.budget() > budget);
+
+    // the lock was taken without waiting, the budget does not move
+    budget = backoff.budget();
+    backoff.acquired(backoff.start());
+    assert(backoff.budget() == budget);
+
+    // a blocked reader spins then parks, a spinning mutex still hands over
+    RWMutexImpl<RWMutexNullDeadLockDetector, RWMutexWriterPreferring,
+        RWMutexNullStats, RWMutexAdaptiveBackoffImpl<16, 64, 4>>
+        m;
+    m.write_lock();
+    std::thread r([&]() {
+        m.read_lock();
+        m.read_unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    m.write_unlock();
+    r.join();
+    assert(RWMutexDiag::IsLocked(m) == false);
+}
+
 void test_dead_lock_detector()
 {
     {
         RWMutexChecked m;
         m.read_lock();
         m.read_lock();
+        m.read_unlock();
+        m.read_unlock();
     }
     {
         RWMutexChecked m;
@@ -220,6 +559,7 @@ void test_dead_lock_detector()
             good = true;
         }
         assert(good);
+        m.write_unlock();
     }
     {
         RWMutexChecked m;
@@ -231,6 +571,7 @@ void test_dead_lock_detector()
             good = true;
         }
         assert(good);
+        m.read_unlock();
     }
     {
         RWMutexChecked m;
@@ -242,7 +583,125 @@ void test_dead_lock_detector()
             good = true;
         }
         assert(good);
+        m.write_unlock();
+    }
+    {
+        // the try locks still check the mix
+        RWMutexChecked m;
+        bool good = false;
+        m.write_lock();
+        try {
+            m.try_read_lock();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        m.write_unlock();
+    }
+    {
+        RWMutexChecked m;
+        bool good = false;
+        m.upgradable_lock();
+        m.read_lock();
+        try {
+            m.upgrade();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        m.read_unlock();
+        m.upgrade();
+        m.downgrade();
+        m.read_unlock();
+    }
+    {
+        // a failed upgrade keeps the read lock of the thread in the detector
+        RWMutexChecked m;
+        bool good = false;
+        m.read_lock();
+        try {
+            m.upgrade();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        good = false;
+        try {
+            m.write_lock();
+        } catch (std::logic_error&) {
+            good = true;
+        }
+        assert(good);
+        m.read_unlock();
+    }
+}
+
+std::atomic<int> lock_order_reports { 0 };
+
+void test_lock_order()
+{
+    RWMutexDeadLockDetector::set_lock_order_handler(
+        [](const void*, const void*) { ++lock_order_reports; });
+    RWMutexChecked a;
+    RWMutexChecked b;
+    // a then b on one thread, b then a on another one
+    std::thread([&]() {
+        a.read_lock();
+        b.write_lock();
+        b.write_unlock();
+        a.read_unlock();
+    }).join();
+    assert(lock_order_reports == 0);
+    std::thread([&]() {
+        b.read_lock();
+        a.read_lock();
+        a.read_unlock();
+        b.read_unlock();
+    }).join();
+    assert(lock_order_reports == 1);
+    // reported once
+    b.write_lock();
+    a.write_lock();
+    a.write_unlock();
+    b.write_unlock();
+    assert(lock_order_reports == 1);
+
+    // a destroyed mutex leaves the graph
+    {
+        RWMutexChecked c;
+        c.write_lock();
+        a.write_lock();
+        a.write_unlock();
+        c.write_unlock();
+    }
+    {
+        RWMutexChecked c;
+        a.write_lock();
+        c.write_lock();
+        c.write_unlock();
+        a.write_unlock();
+    }
+    assert(lock_order_reports == 1);
+
+    // a try or timed lock backs off, it records no order
+    {
+        RWMutexChecked c;
+        RWMutexChecked d;
+        std::thread([&]() {
+            d.write_lock();
+            assert(c.try_write_lock());
+            c.write_unlock();
+            assert(c.try_read_lock_for(std::chrono::milliseconds(1)));
+            c.read_unlock();
+            d.write_unlock();
+        }).join();
+        c.write_lock();
+        d.write_lock();
+        d.write_unlock();
+        c.write_unlock();
     }
+    assert(lock_order_reports == 1);
+    RWMutexDeadLockDetector::set_lock_order_handler(nullptr);
 }
 
 int main()
@@ -250,6 +709,15 @@ int main()
     test_multi_read();
     test_write();
     test_multi_read_one_write();
+    test_many_readers();
+    test_try_lock();
+    test_timed_lock();
+    test_upgradable();
+    test_fairness();
+    test_priority_handoff();
+    test_stats();
+    test_backoff();
     test_dead_lock_detector();
+    test_lock_order();
     return 0;
 }
\ No newline at end of file
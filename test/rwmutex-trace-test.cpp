@@ -0,0 +1,130 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <hsqr/rwlock.h>
+#include <hsqr/rwmutex-trace.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hsqr;
+
+using TracedMutex = RWMutexImpl<RWMutexNullDeadLockDetector,
+    RWMutexWriterPreferring, RWMutexTracing>;
+
+std::size_t count(const std::string& s, const std::string& what)
+{
+    std::size_t n = 0;
+    for (auto pos = s.find(what); pos != std::string::npos;
+         pos = s.find(what, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+std::string dump()
+{
+    std::ostringstream out;
+    RWMutexTrace::dump(out);
+    return out.str();
+}
+
+void test_disabled()
+{
+    RWMutexTrace::clear();
+    TracedMutex m;
+    m.write_lock();
+    m.write_unlock();
+    m.read_lock();
+    m.read_unlock();
+    assert(count(dump(), "\"ph\":\"X\"") == 0);
+}
+
+void test_events()
+{
+    RWMutexTrace::clear();
+    RWMutexTrace::enable();
+    RWLock<int, TracedMutex> lk(std::in_place, 0);
+    constexpr int N = 100;
+    std::vector<std::thread> v;
+    for (int t = 0; t < 2; ++t) {
+        v.push_back(std::thread([&]() {
+            for (int i = 0; i < N; ++i) {
+                *lk.write() += 1;
+                assert(*lk.read() > 0);
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+    RWMutexTrace::disable();
+    // not recorded
+    *lk.write() += 1;
+
+    auto json = dump();
+    assert(json.rfind("{\"traceEvents\":[", 0) == 0);
+    assert(count(json, "\"write wait\"") == 2 * N);
+    assert(count(json, "\"write hold\"") == 2 * N);
+    assert(count(json, "\"read wait\"") == 2 * N);
+    assert(count(json, "\"read hold\"") == 2 * N);
+}
+
+// the events carry the address of the mutex, not of its stats member
+void test_mutex_id()
+{
+    RWMutexTrace::clear();
+    RWMutexTrace::enable();
+    TracedMutex m;
+    m.write_lock();
+    m.write_unlock();
+    RWMutexTrace::disable();
+
+    std::ostringstream id;
+    id << static_cast<const void*>(&m);
+    auto json = dump();
+    assert(count(json, "\"mutex\":\"" + id.str() + "\"") == 2);
+}
+
+// a thread waiting at dump time shows up, a failed try lock is closed
+void test_blocked()
+{
+    RWMutexTrace::clear();
+    RWMutexTrace::enable();
+    TracedMutex m;
+    m.write_lock();
+    assert(!m.try_read_lock());
+    std::atomic<bool> started { false };
+    std::thread t([&]() {
+        started = true;
+        m.write_lock();
+        m.write_unlock();
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    auto json = dump();
+    assert(count(json, "\"abandoned\":true") == 1);
+    assert(count(json, "\"blocked\":true") == 1);
+    auto blocked = json.find("\"blocked\":true");
+    assert(json.rfind("\"write wait\"", blocked) > json.rfind("\"read wait\"", blocked));
+
+    m.write_unlock();
+    t.join();
+    RWMutexTrace::disable();
+    json = dump();
+    assert(count(json, "\"blocked\":true") == 0);
+    assert(count(json, "\"write wait\"") == 2);
+}
+
+int main()
+{
+    test_disabled();
+    test_events();
+    test_mutex_id();
+    test_blocked();
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <cassert>
+#include <hsqr/sharded-rwlock.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace hsqr;
+
+using Map = std::unordered_map<int, int>;
+
+void test_routing()
+{
+    ShardedRWLock<Map, 8> map;
+    // the same key always lands on the same shard, and keys spread
+    std::vector<int> counts(map.size(), 0);
+    for (int key = 0; key < 800; ++key) {
+        auto index = map.shard_index(key);
+        assert(index == map.shard_index(key));
+        assert(&map.shard(key) == &map.shard_at(index));
+        ++counts[index];
+    }
+    for (auto count : counts) {
+        assert(count > 50);
+    }
+
+    (*map.write(1))[1] = 10;
+    (*map.write(std::string("a")))[2] = 20;
+    assert((*map.read(1)).at(1) == 10);
+    assert((*map.read(std::string("a"))).at(2) == 20);
+}
+
+void test_concurrent_keys()
+{
+    ShardedRWLock<Map> map;
+    constexpr int N = 8;
+    constexpr int K = 2000;
+    std::vector<std::thread> v;
+    for (int i = 0; i < N; ++i) {
+        v.push_back(std::thread([&, i]() {
+            for (int k = 0; k < K; ++k) {
+                int key = i * K + k;
+                (*map.write(key))[key] = key;
+                assert((*map.read(key)).at(key) == key);
+            }
+        }));
+    }
+    for (auto& t : v) {
+        t.join();
+    }
+
+    size_t total = 0;
+    map.for_each([&](const Map& shard) { total += shard.size(); });
+    assert(total == N * K);
+
+    auto snapshot = map.snapshot();
+    assert(snapshot.size() == map.size());
+    total = 0;
+    for (auto& shard : snapshot) {
+        total += shard.size();
+    }
+    assert(total == N * K);
+
+    map.clear();
+    total = 0;
+    map.for_each([&](const Map& shard) { total += shard.size(); });
+    assert(total == 0);
+    // the clear kept the snapshot
+    assert(snapshot[0].size() > 0);
+}
+
+void test_whole_structure_ops()
+{
+    ShardedRWLock<int, 4> counters;
+    // two threads locking everything at once do not dead lock
+    std::thread t([&]() {
+        for (int i = 0; i < 1000; ++i) {
+            auto guards = counters.write_all();
+            for (auto& g : guards) {
+                ++*g;
+            }
+        }
+    });
+    for (int i = 0; i < 1000; ++i) {
+        auto guards = counters.write_all();
+        for (auto& g : guards) {
+            ++*g;
+        }
+    }
+    t.join();
+    for (auto value : counters.snapshot()) {
+        assert(value == 2000);
+    }
+}
+
+int main()
+{
+    test_routing();
+    test_concurrent_keys();
+    test_whole_structure_ops();
+    return 0;
+}